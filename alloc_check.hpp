@@ -0,0 +1,51 @@
+#pragma once
+// counts heap allocations per thread, for checking that a hot loop doesn't allocate.
+//
+// with -DKOMI_ALLOC_CHECK this replaces the global operator new, so include it
+// from exactly one translation unit, the one with main(). alloc_check_count()
+// is how many allocations the calling thread has made so far; compare it
+// before and after a frame. only operator new is counted, C libraries calling
+// malloc directly are not. without the flag nothing is replaced and the count
+// stays 0.
+#include <cstddef>
+#include <cstdint>
+
+#ifdef KOMI_ALLOC_CHECK
+#include <cstdlib>
+#include <new>
+
+namespace alloc_check_detail {
+inline thread_local uint64_t count = 0;
+
+inline void* allocate(std::size_t size, std::size_t alignment) {
+    count++;
+    if (size == 0) size = 1;
+    void* p = alignment > alignof(std::max_align_t)
+        ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+        : std::malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+} // namespace alloc_check_detail
+
+void* operator new(std::size_t size) { return alloc_check_detail::allocate(size, 0); }
+void* operator new[](std::size_t size) { return alloc_check_detail::allocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return alloc_check_detail::allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return alloc_check_detail::allocate(size, static_cast<std::size_t>(alignment));
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+inline uint64_t alloc_check_count() { return alloc_check_detail::count; }
+#else
+inline uint64_t alloc_check_count() { return 0; }
+#endif
@@ -10,6 +10,24 @@ fi
 # compile programs
 g++ komi.cpp -o komi -lraylib -lGL -lm -lpthread -ldl -lrt 
 g++ server.cpp -o server -lboost_system
+g++ mkmap.cpp -o mkmap
+g++ gateway.cpp -o gateway -lboost_system -lpthread
+g++ komi_relay.cpp -o komi_relay -lboost_system -lpthread
+g++ komi_bot.cpp -o komi_bot -lboost_system -lpthread
+g++ komi_netem.cpp -o komi_netem -lboost_system -lpthread
+
+# the client's frame code must not allocate: play it headless under the allocation counter
+g++ -DKOMI_ALLOC_CHECK komi.cpp -o komi_alloc_check -lraylib -lGL -lm -lpthread -ldl -lrt
+if ! ./komi_alloc_check --alloc-check 1200; then
+    echo "komi's frame loop allocates, see above"
+    exit 1
+fi
+
+# generate the default map if it doesn't exist yet
+mkdir -p maps
+if [ ! -f maps/arena.kmap ]; then
+    ./mkmap maps/arena.kmap
+fi
 
 # start server in background
 ./server &
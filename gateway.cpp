@@ -0,0 +1,296 @@
+// komi gateway: one public endpoint in front of several game server processes.
+//
+// a client's first line is "Join <match>". the gateway sends every client of a
+// match to the same backend and places new matches on the least loaded backend
+// that isn't draining. after that it just copies bytes both ways. backends
+// report load on their admin port (see admin_session in server.cpp), polled
+// here twice a second.
+//
+//   ./server --port 9001 --admin-port 10001 &
+//   ./server --port 9002 --admin-port 10002 &
+//   ./gateway --port 8080 --backend 127.0.0.1:9001:10001 --backend 127.0.0.1:9002:10002
+//
+// "Spectate <match>" goes to the backend already hosting that match, or gets
+// "NoMatch" back. spectators never start a match. big audiences should watch
+// through komi_relay rather than connecting here one by one.
+//
+// a backend is marked down after DOWN_AFTER_FAILED_POLLS failed polls in a
+// row. joins to a match on a down backend get "Full" until the match's last
+// connection has closed, only then is the match placed somewhere else.
+//
+// draining a backend for a deploy: `echo Drain | nc 127.0.0.1 10001`. matches
+// already on it keep playing, new matches go elsewhere, and once it reports
+// players=0 it can be restarted.
+#include <boost/asio.hpp>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <sstream>
+#include <array>
+
+using boost::asio::ip::tcp;
+
+struct Backend {
+    std::string host;
+    unsigned short port;        // game traffic
+    unsigned short admin_port;  // load reports
+    bool healthy = false;
+    int failed_polls = 0;       // in a row, it's only marked down after a few
+    bool draining = false;
+    int players = 0;
+    int rooms = 0;
+    float lateness_ms = 0.0f;
+};
+
+struct Match {
+    size_t backend;
+    uint64_t placement;   // tells a re-placed match from the one a connection joined
+    int connections = 0;
+};
+
+std::vector<Backend> backends;
+std::unordered_map<std::string, Match> matches;
+uint64_t next_placement = 1;
+std::mutex routing_mutex;
+
+const auto POLL_INTERVAL = std::chrono::milliseconds(500);
+const int DOWN_AFTER_FAILED_POLLS = 3; // one slow poll isn't a dead backend
+
+std::vector<std::string> split_by_space(const std::string& input) {
+    std::istringstream iss(input);
+    std::string word;
+    std::vector<std::string> words;
+
+    while (iss >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// asks one backend for "Status players=.. rooms=.. lateness_ms=.. draining=.."
+bool query_backend(const Backend& backend, Backend& status) {
+    try {
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        socket.connect(tcp::endpoint(boost::asio::ip::make_address(backend.host), backend.admin_port));
+        boost::asio::write(socket, boost::asio::buffer(std::string("Status\n")));
+
+        boost::asio::streambuf buf;
+        boost::asio::read_until(socket, buf, "\n");
+        std::istream is(&buf);
+        std::string line;
+        std::getline(is, line);
+
+        std::vector<std::string> tokens = split_by_space(line);
+        if (tokens.empty() || tokens[0] != "Status") return false;
+        for (size_t i = 1; i < tokens.size(); i++) {
+            size_t eq = tokens[i].find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = tokens[i].substr(0, eq);
+            std::string value = tokens[i].substr(eq + 1);
+            if (key == "players")          status.players = std::stoi(value);
+            else if (key == "rooms")       status.rooms = std::stoi(value);
+            else if (key == "lateness_ms") status.lateness_ms = std::stof(value);
+            else if (key == "draining")    status.draining = value == "1";
+        }
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+void poll_backends() {
+    while (true) {
+        for (size_t i = 0; i < backends.size(); i++) {
+            Backend target;
+            {
+                std::lock_guard<std::mutex> lock(routing_mutex);
+                target = backends[i];
+            }
+            Backend status;
+            bool ok = query_backend(target, status);
+
+            std::lock_guard<std::mutex> lock(routing_mutex);
+            Backend& backend = backends[i];
+            backend.failed_polls = ok ? 0 : backend.failed_polls + 1;
+            bool healthy = ok || (backend.healthy && backend.failed_polls < DOWN_AFTER_FAILED_POLLS);
+            if (healthy != backend.healthy) {
+                std::cout << "Backend " << backend.host << ":" << backend.port
+                          << (healthy ? " is up" : " is down") << std::endl;
+            }
+            backend.healthy = healthy;
+            if (ok) {
+                backend.players = status.players;
+                backend.rooms = status.rooms;
+                backend.lateness_ms = status.lateness_ms;
+                backend.draining = status.draining;
+            }
+        }
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+}
+
+// returns the backend for a match: the one already hosting it, or the least
+// loaded free backend that isn't draining. -1 if there's nowhere to put it.
+// placement identifies this placement of the match for release_match.
+int place_match(const std::string& name, uint64_t& placement) {
+    std::lock_guard<std::mutex> lock(routing_mutex);
+
+    // a match whose backend went down stays there until its last connection is
+    // gone. placing it again now would split its players across two backends.
+    auto it = matches.find(name);
+    if (it != matches.end()) {
+        if (!backends[it->second.backend].healthy) return -1;
+        it->second.connections++;
+        placement = it->second.placement;
+        return static_cast<int>(it->second.backend);
+    }
+
+    // one match per server process, so a backend hosting anything is taken
+    std::vector<bool> hosting(backends.size(), false);
+    for (const auto& [match_name, match] : matches) hosting[match.backend] = true;
+
+    int best = -1;
+    for (size_t i = 0; i < backends.size(); i++) {
+        const Backend& b = backends[i];
+        if (!b.healthy || b.draining || b.rooms > 0 || hosting[i]) continue;
+        if (best < 0 || b.lateness_ms < backends[best].lateness_ms) best = static_cast<int>(i);
+    }
+    if (best >= 0) {
+        placement = next_placement++;
+        matches[name] = {static_cast<size_t>(best), placement, 1};
+        std::cout << "Match " << name << " placed on " << backends[best].host << ":" << backends[best].port << std::endl;
+    }
+    return best;
+}
+
+// the backend hosting a running match, for spectators. -1 if it isn't running.
+int find_match(const std::string& name, uint64_t& placement) {
+    std::lock_guard<std::mutex> lock(routing_mutex);
+    auto it = matches.find(name);
+    if (it == matches.end() || !backends[it->second.backend].healthy) return -1;
+    it->second.connections++;
+    placement = it->second.placement;
+    return static_cast<int>(it->second.backend);
+}
+
+// a connection to the given placement of the match closed
+void release_match(const std::string& name, uint64_t placement) {
+    std::lock_guard<std::mutex> lock(routing_mutex);
+    auto it = matches.find(name);
+    if (it == matches.end() || it->second.placement != placement) return;
+    if (--it->second.connections <= 0) {
+        std::cout << "Match " << name << " ended" << std::endl;
+        matches.erase(it);
+    }
+}
+
+// copies bytes one way until either side closes, then closes both
+void pump(tcp::socket& from, tcp::socket& to) {
+    std::array<char, 8192> data;
+    boost::system::error_code ec;
+    while (true) {
+        size_t n = from.read_some(boost::asio::buffer(data), ec);
+        if (ec) break;
+        boost::asio::write(to, boost::asio::buffer(data, n), ec);
+        if (ec) break;
+    }
+    from.shutdown(tcp::socket::shutdown_both, ec);
+    to.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+void client_session(std::shared_ptr<tcp::socket> client) {
+    std::string match = "default";
+    bool spectating = false;
+    boost::asio::streambuf buf;
+    try {
+        boost::asio::read_until(*client, buf, "\n");
+        std::string first(boost::asio::buffers_begin(buf.data()), boost::asio::buffers_end(buf.data()));
+        std::vector<std::string> tokens = split_by_space(first.substr(0, first.find('\n')));
+        spectating = !tokens.empty() && tokens[0] == "Spectate";
+        if (tokens.size() >= 2 && (tokens[0] == "Join" || spectating)) match = tokens[1];
+    } catch (const std::exception& e) {
+        std::cerr << "Client closed before joining: " << e.what() << std::endl;
+        return;
+    }
+
+    uint64_t placement = 0;
+    int backend_index = spectating ? find_match(match, placement) : place_match(match, placement);
+    if (backend_index < 0) {
+        std::cerr << (spectating ? "No running match " : "No backend free for match ") << match << std::endl;
+        boost::system::error_code ec;
+        boost::asio::write(*client, boost::asio::buffer(std::string(spectating ? "NoMatch\n" : "Full\n")), ec);
+        return;
+    }
+
+    Backend backend;
+    {
+        std::lock_guard<std::mutex> lock(routing_mutex);
+        backend = backends[backend_index];
+    }
+
+    try {
+        auto upstream = std::make_shared<tcp::socket>(client->get_executor());
+        upstream->connect(tcp::endpoint(boost::asio::ip::make_address(backend.host), backend.port));
+        upstream->set_option(tcp::no_delay(true));
+        client->set_option(tcp::no_delay(true));
+
+        // forward the Join or Spectate line and anything that came with it
+        boost::asio::write(*upstream, buf.data());
+
+        std::thread up([client, upstream]() { pump(*client, *upstream); });
+        pump(*upstream, *client);
+        up.join();
+    } catch (const std::exception& e) {
+        std::cerr << "Can't reach backend " << backend.host << ":" << backend.port << ": " << e.what() << std::endl;
+    }
+    release_match(match, placement);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned short port = 8080;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<unsigned short>(std::stoi(argv[++i]));
+        } else if (arg == "--backend" && i + 1 < argc) {
+            // host:port:admin_port
+            std::string spec = argv[++i];
+            size_t a = spec.find(':');
+            size_t b = spec.find(':', a + 1);
+            if (a == std::string::npos || b == std::string::npos) {
+                std::cerr << "Bad backend " << spec << ", expected host:port:admin_port" << std::endl;
+                return 1;
+            }
+            Backend backend;
+            backend.host = spec.substr(0, a);
+            backend.port = static_cast<unsigned short>(std::stoi(spec.substr(a + 1, b - a - 1)));
+            backend.admin_port = static_cast<unsigned short>(std::stoi(spec.substr(b + 1)));
+            backends.push_back(backend);
+        }
+    }
+    if (backends.empty()) {
+        std::cerr << "Usage: gateway [--port N] --backend host:port:admin_port [--backend ...]" << std::endl;
+        return 1;
+    }
+
+    try {
+        boost::asio::io_context io_context;
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), port));
+        std::cout << "Gateway listening on port " << port << " with " << backends.size() << " backends...\n";
+
+        std::thread(poll_backends).detach();
+
+        while (true) {
+            auto socket = std::make_shared<tcp::socket>(io_context);
+            acceptor.accept(*socket);
+            std::thread(client_session, socket).detach();
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Gateway error: " << e.what() << std::endl;
+    }
+    return 0;
+}
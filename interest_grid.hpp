@@ -0,0 +1,77 @@
+#pragma once
+// uniform grid over the arena for area-of-interest queries.
+//
+// rebuilt once per tick with a counting sort, so items of one cell are
+// contiguous and a query only walks the cells its rectangle overlaps.
+// queries are read-only and can run from several threads at once.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class InterestGrid {
+public:
+    InterestGrid(float width, float height, float cell_size)
+        : cell(cell_size),
+          cols(std::max(1, static_cast<int>(std::ceil(width / cell_size)))),
+          rows(std::max(1, static_cast<int>(std::ceil(height / cell_size)))),
+          cell_start(static_cast<size_t>(cols) * rows + 1, 0) {}
+
+    // rebuilds the grid from count points. position(i) returns {x, y} of point i,
+    // and queries report i.
+    template <typename PositionFn>
+    void build(size_t count, PositionFn position) {
+        std::fill(cell_start.begin(), cell_start.end(), 0);
+        item_cells.resize(count);
+        items.resize(count);
+
+        for (size_t i = 0; i < count; i++) {
+            auto [x, y] = position(i);
+            uint32_t c = cell_of(x, y);
+            item_cells[i] = c;
+            cell_start[c + 1]++;
+        }
+        for (size_t c = 1; c < cell_start.size(); c++) cell_start[c] += cell_start[c - 1];
+
+        // scatter in index order, so every cell lists its items in ascending index
+        fill.assign(cell_start.begin(), cell_start.end() - 1);
+        for (size_t i = 0; i < count; i++) {
+            auto [x, y] = position(i);
+            items[fill[item_cells[i]]++] = {static_cast<uint32_t>(i), x, y};
+        }
+    }
+
+    // appends the index of every point inside the rectangle to out, unsorted
+    void query(float min_x, float min_y, float max_x, float max_y, std::vector<uint32_t>& out) const {
+        int c0 = clamp_col(min_x), c1 = clamp_col(max_x);
+        int r0 = clamp_row(min_y), r1 = clamp_row(max_y);
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++) {
+                size_t cell_index = static_cast<size_t>(r) * cols + c;
+                for (uint32_t k = cell_start[cell_index]; k < cell_start[cell_index + 1]; k++) {
+                    const Item& item = items[k];
+                    if (item.x >= min_x && item.x <= max_x && item.y >= min_y && item.y <= max_y) {
+                        out.push_back(item.index);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Item {
+        uint32_t index;
+        float x, y;
+    };
+
+    int clamp_col(float x) const { return std::clamp(static_cast<int>(std::floor(x / cell)), 0, cols - 1); }
+    int clamp_row(float y) const { return std::clamp(static_cast<int>(std::floor(y / cell)), 0, rows - 1); }
+    uint32_t cell_of(float x, float y) const { return static_cast<uint32_t>(clamp_row(y) * cols + clamp_col(x)); }
+
+    float cell;
+    int cols, rows;
+    std::vector<uint32_t> cell_start; // prefix sums, cell c spans [cell_start[c], cell_start[c + 1])
+    std::vector<uint32_t> item_cells;
+    std::vector<uint32_t> fill;
+    std::vector<Item> items;
+};
@@ -0,0 +1,148 @@
+#pragma once
+// small work-stealing job scheduler for splitting per-tick work across cores.
+//
+// parallel_for() cuts a range into chunks and spreads them over per-thread
+// queues. each thread pops from the back of its own queue and steals from the
+// front of the others when it runs dry. the calling thread works too, and the
+// call returns once every chunk has run. chunks carry a worker index so
+// callers can write into per-thread buffers without locking.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+    // worker_count extra threads are started, the caller of parallel_for is worker 0
+    explicit JobSystem(unsigned worker_count) {
+        queues.reserve(worker_count + 1);
+        for (unsigned i = 0; i <= worker_count; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 1; i <= worker_count; i++) {
+            threads.emplace_back(&JobSystem::worker_main, this, i);
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // number of threads that may run chunks, including the caller
+    unsigned thread_count() const { return static_cast<unsigned>(queues.size()); }
+
+    // runs fn(begin, end, worker) over [0, count) in chunks of at most chunk_size.
+    // only one parallel_for may be in flight at a time.
+    template <typename Fn>
+    void parallel_for(size_t count, size_t chunk_size, Fn&& fn) {
+        if (count == 0) return;
+        chunk_size = std::max<size_t>(chunk_size, 1);
+        if (count <= chunk_size || queues.size() == 1) {
+            fn(size_t(0), count, 0u); // not worth waking anyone
+            return;
+        }
+
+        Task task;
+        task.run = [](void* ctx, size_t begin, size_t end, unsigned worker) {
+            (*static_cast<Fn*>(ctx))(begin, end, worker);
+        };
+        task.ctx = &fn;
+        size_t chunks = (count + chunk_size - 1) / chunk_size;
+        task.remaining.store(chunks);
+
+        for (size_t c = 0; c < chunks; c++) {
+            size_t begin = c * chunk_size;
+            Queue& q = *queues[c % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.jobs.push_back({&task, begin, std::min(begin + chunk_size, count)});
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            queued += chunks;
+        }
+        wake.notify_all();
+
+        // help out until every chunk has finished
+        while (task.remaining.load(std::memory_order_acquire) != 0) {
+            if (!run_one(0)) std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Task {
+        void (*run)(void*, size_t, size_t, unsigned);
+        void* ctx;
+        std::atomic<size_t> remaining{0};
+    };
+
+    struct Job {
+        Task* task;
+        size_t begin, end;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    bool pop(unsigned worker, Job& job) {
+        // own queue first (back), then steal from the others (front)
+        for (size_t i = 0; i < queues.size(); i++) {
+            Queue& q = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.jobs.empty()) continue;
+            if (i == 0) {
+                job = q.jobs.back();
+                q.jobs.pop_back();
+            } else {
+                job = q.jobs.front();
+                q.jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool run_one(unsigned worker) {
+        Job job;
+        if (!pop(worker, job)) return false;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            queued--;
+        }
+        job.task->run(job.task->ctx, job.begin, job.end, worker);
+        job.task->remaining.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void worker_main(unsigned worker) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait(lock, [this] { return stopping || queued > 0; });
+                if (stopping) return;
+            }
+            while (run_one(worker)) {}
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    size_t queued = 0;
+    bool stopping = false;
+};
@@ -7,6 +7,20 @@
 #include <sstream>
 #include <unordered_map>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "alloc_check.hpp"
+#include "latency.hpp"
+#include "map.hpp"
+#include "slot_map.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
+#include "weapons.hpp"
 
 enum class GameState {
     Ongoing,
@@ -20,10 +34,9 @@ tcp::socket* global_socket = nullptr;
 std::string player_id;
 bool player_id_received = false;
 
-// thread-safe storage for other players
-std::unordered_map<int, Vector2> other_players;
-std::mutex other_players_mutex;
 std::mutex enemies_mutex;
+std::mutex bullets_mutex;
+std::mutex send_mutex;
 
 int player_score = 0;
 int enemy_score = 0;
@@ -32,34 +45,98 @@ int shoot_fx_time = 0;
 
 bool waiting_for_restart = false;
 
-std::string selected_weapon = "pistol";
-std::string direction = "up";
-std::string latest_right_direction = "up";
+// hit and waiting to respawn: the server rejects our shots until its Respawn
+std::atomic<bool> player_down{false};
+
+// round trip the server last measured for us, from its Ping
+std::atomic<int> rtt_ms{0};
+const auto client_start = std::chrono::steady_clock::now();
+
+// input-to-display latency of other players' shots, printed on exit. only with --measure.
+bool measure_latency = false;
+std::mutex latency_mutex;
+ClockOffset clock_offset;
+LatencyTracker latency_tracker;
+LatencyStats latency_stats;
+
+// with -DKOMI_ALLOC_CHECK, a frame that allocates once the game is running aborts
+const int ALLOC_WARMUP_FRAMES = 600;
+
+// kill -USR2 <pid> dumps the last few seconds of frame traces
+std::atomic<bool> trace_dump_requested{false};
+const double TRACE_DUMP_SECONDS = 5.0;
+
+// facing, in aim order: the aim angle is the value times 45 degrees
+enum class Direction : uint8_t { Right, TopRight, Up, TopLeft, Left, BottomLeft, Down, BottomRight };
+
+int selected_weapon = find_weapon("pistol"); // index into WEAPONS
+Direction direction = Direction::Up;
+Direction latest_right_direction = Direction::Up;
 
 const int screenWidth  = 1280;
 const int screenHeight = 720;
 
+// the arena can be larger than the screen, the server sends its size on join
+float arena_width  = screenWidth;
+float arena_height = screenHeight;
+bool  arena_received = false;
+std::string pending_map; // map named by the server, opened on the main thread
+size_t pending_map_size = 0;       // the server's copy, 0 if it didn't say
+uint32_t pending_map_checksum = 0;
+std::string pending_map_error;     // a Map line we can't use, we can't play without its walls
+std::mutex arena_mutex;
+
+// static walls, same file as the server's
+MapView game_map;
+
 struct Bullet {
+    uint32_t id = 0;      // server id, 0 while only predicted
+    uint32_t seq = 0;     // our shot tag, 0 for other players' bullets
+    uint32_t pellet = 0;
     Vector2 position;
-    float speed = 1600.0f;
-    std::string direction;
+    Vector2 velocity;
+    double fired_at = 0;  // when a predicted bullet was fired
+    uint32_t seen_tick = 0;
+    bool measured = false; // its shot's latency is recorded when it's first drawn
     static constexpr float RADIUS = 5.0f;         
 };
 
+// another player, stored under the server's client id
 struct Enemy {
     Vector2 position;
-    float   speed = 10.0f;
-    int client_id;          
+    uint32_t seen_tick = 0;
     static constexpr float RADIUS = 15.0f;
 };
 
-std::vector<Bullet> bullets;
-std::vector<Enemy>  enemies;
+// bullets the server confirmed, by id, moved locally between snapshots and
+// nudged towards the server's position when one arrives
+std::unordered_map<uint32_t, Bullet> bullets;
+// our own shots, drawn the moment we fire and adopted by the server's bullet
+// with the same seq and pellet. dropped if the server never confirms them.
+std::vector<Bullet> predicted_bullets;
+uint32_t next_shot_seq = 1;
+int my_client_id = -1;
 
-void send_to_server(const std::string& msg) {
+const float BULLET_CORRECTION = 0.25f; // share of the error removed per snapshot
+const float BULLET_SNAP_DISTANCE = 80.0f; // further off than this and we jump
+
+// other players, keyed by the server's ids so lookups from snapshots are O(1)
+SlotMap<Enemy> enemies;
+
+// reconstructed server snapshots, baselines for incoming deltas
+SnapshotHistory snapshot_history;
+SnapshotDecoder snapshot_decoder;
+
+uint64_t client_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - client_start).count();
+}
+
+void send_to_server(const char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(send_mutex);
     try {
         if (global_socket && global_socket->is_open()) {
-            boost::asio::write(*global_socket, boost::asio::buffer(msg));
+            boost::asio::write(*global_socket, boost::asio::buffer(data, size));
         } else {
             std::cerr << "Socket is not connected!" << std::endl;
         }
@@ -68,41 +145,42 @@ void send_to_server(const std::string& msg) {
     }
 }
 
+void send_to_server(const std::string& msg) {
+    send_to_server(msg.data(), msg.size());
+}
+
+// formats one message into a stack buffer, for messages sent every frame
+template <typename... Args>
+void send_formatted(const char* fmt, Args... args) {
+    char msg[128];
+    int len = snprintf(msg, sizeof(msg), fmt, args...);
+    if (len > 0) send_to_server(msg, std::min<size_t>(len, sizeof(msg) - 1));
+}
+
 void send_player_position(float circleX, float circleY) {
-    std::string msg = "Position " + std::to_string(circleX) + ", " + std::to_string(circleY) + "\n";
-    send_to_server(msg);
-}
-
-void send_bullet_position(Bullet bullet) {
-    std::string msg;
-    if (selected_weapon == "pistol") {
-        msg = "Shot " + std::to_string(bullet.position.x) + " " + std::to_string(bullet.position.y) + " " + std::to_string(bullet.speed) + " " + bullet.direction + "\n";
-        send_to_server(msg);
-    } else if (selected_weapon == "shotgun") {
-        // define spread directions for each base direction
-        static const std::unordered_map<std::string, std::vector<std::string>> spread_directions = {
-            {"top_right",          {"up", "top_right", "right"}},
-            {"top_left",          {"up", "top_left", "left"}},
-            {"bottom_right",          {"down", "bottom_right", "right"}},
-            {"bottom_left",          {"down", "bottom_left", "left"}},
-            {"right",       {"right", "top_right", "bottom_right"}},
-            {"left",        {"left", "top_left", "bottom_left"}},
-            {"up",          {"up", "top_left", "top_right"}},
-            {"down",        {"down", "bottom_left", "bottom_right"}}
-        };
-
-        auto it = spread_directions.find(bullet.direction);
-        if (it != spread_directions.end()) {
-            for (const std::string& dir : it->second) {
-                msg = "Shot " + std::to_string(bullet.position.x) + " " +
-                      std::to_string(bullet.position.y) + " " +
-                      std::to_string(bullet.speed) + " " + dir + "\n";
-                send_to_server(msg);
-            }
-        } else {
-            std::cerr << "Unknown direction: " << latest_right_direction << "\n";
+    send_formatted("Position %f, %f\n", circleX, circleY);
+}
+
+// facing direction as an aim angle in degrees, counter-clockwise from right
+float direction_to_degrees(Direction dir) {
+    return static_cast<int>(dir) * 45.0f;
+}
+
+// one message per shot, the server expands the pellets and echoes seq on each of them.
+// once we know the server clock the shot also carries when its key was read and when it was sent.
+void send_fire(int weapon_index, float aim_degrees, uint32_t seq, uint64_t input_us) {
+    bool stamped;
+    unsigned long long input_server_us = 0, send_server_us = 0;
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        stamped = measure_latency && clock_offset.ready();
+        if (stamped) {
+            input_server_us = clock_offset.to_server(input_us);
+            send_server_us = clock_offset.to_server(client_now_us());
         }
     }
+    if (stamped) send_formatted("Fire %d %f %u %llu %llu\n", weapon_index, aim_degrees, seq, input_server_us, send_server_us);
+    else send_formatted("Fire %d %f %u\n", weapon_index, aim_degrees, seq);
 }
 
 std::vector<std::string> split_by_space(std::string input) {
@@ -116,73 +194,198 @@ std::vector<std::string> split_by_space(std::string input) {
     return words;
 }
 
-void create_enemy_for_player(int client_id, Vector2 position) {
-    std::lock_guard<std::mutex> lock(enemies_mutex);
-    
-    // check if enemy already exists for this player
-    for (const auto& enemy : enemies) {
-        if (enemy.client_id == client_id) {
-            return; // enemy already exists
-        }
-    }
-    
-    // create new enemy
-    Enemy e{
-        position,
-        10.0f,
-        client_id
-    };
-    enemies.push_back(std::move(e));
-    std::cout << "Created enemy for player " << client_id << std::endl;
-}
-
-void update_enemy_position(int client_id, Vector2 position) {
-    std::lock_guard<std::mutex> lock(enemies_mutex);
-    for (Enemy& enemy : enemies) {
-        if (enemy.client_id == client_id) {
-            enemy.position = position;
-            return;
-        }
+// the caller holds enemies_mutex
+void update_enemy_position(int client_id, Vector2 position, uint32_t tick) {
+    Enemy* enemy = enemies.find(client_id);
+    if (!enemy) {
+        enemies.emplace_at(client_id, Enemy{});
+        enemy = enemies.find(client_id);
+        if (!enemy) return; // not an id the server could have sent
     }
+    enemy->position = position;
+    enemy->seen_tick = tick;
 }
 
 void remove_enemy_for_player(int client_id) {
     std::lock_guard<std::mutex> lock(enemies_mutex);
-    enemies.erase(std::remove_if(enemies.begin(), enemies.end(),
-        [client_id](const Enemy& e) {
-            return e.client_id == client_id;
-        }), enemies.end());
-    std::cout << "Removed enemy for player " << client_id << std::endl;
+    if (enemies.erase(client_id)) {
+        std::cout << "Removed enemy for player " << client_id << std::endl;
+    }
 }
 
 
 void handle_client_id(const std::vector<std::string>& tokens) {
     if (tokens.size() < 2) return;
     player_id = tokens[1];
+    try {
+        my_client_id = std::stoi(player_id);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing client id: " << e.what() << std::endl;
+    }
     player_id_received = true;
     std::cout << "PLAYER ID HAS BEEN SET TO " << player_id << std::endl;
 }
 
-void handle_bullets_start() {
-    bullets.clear();
+void handle_arena(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 3) return;
+
+    try {
+        std::lock_guard<std::mutex> lock(arena_mutex);
+        arena_width = std::stof(tokens[1]);
+        arena_height = std::stof(tokens[2]);
+        arena_received = true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing arena message: " << e.what() << std::endl;
+    }
 }
 
-void handle_bullet_update(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 6) return;
+void handle_map(const std::vector<std::string>& tokens) {
+    std::lock_guard<std::mutex> lock(arena_mutex);
+    // only plain file names, maps always come from our own maps/ directory
+    if (tokens.size() < 2 || tokens[1].find('/') != std::string::npos) {
+        pending_map_error = "server sent an invalid map name";
+        return;
+    }
 
-    try {
-        float x = std::stof(tokens[1]);
-        float y = std::stof(tokens[2]);
-        std::string direction = tokens[3];
-        float speed = std::stof(tokens[4]);
-        float radius = std::stof(tokens[5]);
+    // Map <name> <size> <checksum>, so we can tell our copy differs from the server's
+    size_t size = 0;
+    uint32_t checksum = 0;
+    if (tokens.size() >= 4) {
+        try {
+            size = std::stoull(tokens[2]);
+            checksum = static_cast<uint32_t>(std::stoul(tokens[3]));
+        } catch (const std::exception& e) {
+            pending_map_error = "server sent an invalid size or checksum for " + tokens[1];
+            return;
+        }
+    }
+
+    pending_map = tokens[1];
+    pending_map_size = size;
+    pending_map_checksum = checksum;
+}
 
-        bullets.push_back({{x, y}, speed, direction});
+void handle_snapshot_begin(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 3) return;
 
+    try {
+        uint32_t tick = static_cast<uint32_t>(std::stoul(tokens[1]));
+        uint32_t base_tick = static_cast<uint32_t>(std::stoul(tokens[2]));
+        if (!snapshot_decoder.begin(tick, base_tick, snapshot_history)) {
+            // we no longer have the baseline, ask for a keyframe
+            send_to_server("Resync\n");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing snapshot header: " << e.what() << std::endl;
+    }
+}
+
+void handle_snapshot_bullet(const std::vector<std::string>& tokens) {
+    try {
+        uint32_t id = static_cast<uint32_t>(std::stoul(tokens[1]));
+        if (tokens[0] == "-B") {
+            snapshot_decoder.bullet_removed(id);
+        } else if (tokens[0] == "b" && tokens.size() >= 4) {
+            snapshot_decoder.bullet_moved(id, std::stof(tokens[2]), std::stof(tokens[3]));
+        } else if (tokens[0] == "B" && tokens.size() >= 9) {
+            snapshot_decoder.bullet_added({id, std::stof(tokens[2]), std::stof(tokens[3]),
+                                           std::stof(tokens[4]), std::stof(tokens[5]),
+                                           std::stoi(tokens[6]), static_cast<uint32_t>(std::stoul(tokens[7])),
+                                           static_cast<uint32_t>(std::stoul(tokens[8]))});
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error parsing bullet message: " << e.what() << std::endl;
     }
 }
+
+void handle_snapshot_player(const std::vector<std::string>& tokens) {
+    try {
+        int id = std::stoi(tokens[1]);
+        if (tokens[0] == "-P") {
+            snapshot_decoder.player_removed(id);
+        } else if (tokens.size() >= 4) {
+            snapshot_decoder.player_updated({id, std::stof(tokens[2]), std::stof(tokens[3])});
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing player message: " << e.what() << std::endl;
+    }
+}
+
+// moves a bullet part of the way to where the server has it, so corrections
+// don't pop. positions are about half a round trip old when they arrive.
+void correct_bullet(Bullet& bullet, const BulletState& state) {
+    float lead = rtt_ms.load() / 2000.0f;
+    Vector2 target = { state.x + state.vx * lead, state.y + state.vy * lead };
+    float ex = target.x - bullet.position.x;
+    float ey = target.y - bullet.position.y;
+    if (ex * ex + ey * ey > BULLET_SNAP_DISTANCE * BULLET_SNAP_DISTANCE) {
+        bullet.position = target;
+    } else {
+        bullet.position.x += ex * BULLET_CORRECTION;
+        bullet.position.y += ey * BULLET_CORRECTION;
+    }
+    bullet.velocity = { state.vx, state.vy };
+}
+
+// merges a snapshot into the bullets we draw. the caller holds bullets_mutex.
+void reconcile_bullets(const WorldSnapshot& snap) {
+    std::lock_guard<std::mutex> latency_lock(latency_mutex);
+    uint64_t received_us = clock_offset.to_server(client_now_us());
+    for (const BulletState& state : snap.bullets) {
+        auto it = bullets.find(state.id);
+        if (it == bullets.end()) {
+            Bullet bullet;
+            bullet.id = state.id;
+            bullet.position = { state.x, state.y };
+
+            // our own shot: continue from the predicted bullet instead of spawning a second one
+            if (state.owner == my_client_id && state.seq != 0) {
+                auto p = std::find_if(predicted_bullets.begin(), predicted_bullets.end(),
+                    [&state](const Bullet& b) { return b.seq == state.seq && b.pellet == state.pellet; });
+                if (p != predicted_bullets.end()) {
+                    bullet.position = p->position;
+                    predicted_bullets.erase(p);
+                }
+            }
+            bullet.measured = latency_tracker.on_received(state.id, received_us);
+            it = bullets.emplace(state.id, bullet).first;
+        }
+        correct_bullet(it->second, state);
+        it->second.seen_tick = snap.tick;
+    }
+
+    // anything the snapshot no longer has hit something, expired or left our view
+    for (auto it = bullets.begin(); it != bullets.end(); ) {
+        if (it->second.seen_tick != snap.tick) it = bullets.erase(it);
+        else ++it;
+    }
+}
+
+void handle_snapshot_end() {
+    TRACE_SCOPE("apply snapshot");
+    const WorldSnapshot* snap = snapshot_decoder.end();
+    if (!snap) return;
+
+    snapshot_history.push(*snap);
+    {
+        std::lock_guard<std::mutex> lock(bullets_mutex);
+        reconcile_bullets(*snap);
+    }
+    {
+        std::lock_guard<std::mutex> lock(enemies_mutex);
+        for (const auto& p : snap->players) {
+            if (p.id == my_client_id) continue;
+            update_enemy_position(p.id, {p.x, p.y}, snap->tick);
+        }
+        // players missing from the snapshot left or walked out of view
+        for (size_t i = 0; i < enemies.size(); ) {
+            if (enemies.value_at(i).seen_tick != snap->tick) enemies.erase(enemies.key_at(i));
+            else i++;
+        }
+    }
+    send_to_server("Ack " + std::to_string(snap->tick) + "\n");
+}
+
 void handle_hit(const std::vector<std::string>& tokens) {
     if (tokens.size() < 3) return;
 
@@ -190,48 +393,27 @@ void handle_hit(const std::vector<std::string>& tokens) {
         int shooter_id = std::stoi(tokens[1]);
         int hit_player_id = std::stoi(tokens[2]);
 
-        if (std::to_string(shooter_id) == player_id) {
-            player_score++;
-            scoreboard_fx_time = 10;
+        // scores arrive separately in Score messages
+        if (shooter_id == my_client_id) {
             std::cout << "We hit player " << hit_player_id << "!" << std::endl;
-        } else if (std::to_string(hit_player_id) == player_id) {
-            enemy_score++;
+        } else if (hit_player_id == my_client_id) {
             std::cout << "We were hit by player " << shooter_id << "!" << std::endl;
+            player_down = true;
         }
 
     } catch (const std::exception& e) {
         std::cerr << "Error parsing hit message: " << e.what() << std::endl;
     }
 }
-void handle_client_position(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 5 || tokens[2] != "Position") return;
-
-    std::string client_id_str = tokens[1];
-    if (client_id_str.back() == ':') client_id_str.pop_back();
-
+void handle_respawn(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) return;
     try {
-        int client_id = std::stoi(client_id_str);
-        if (std::to_string(client_id) == player_id) return;
-
-        std::string x_str = tokens[3];
-        std::string y_str = tokens[4];
-        if (x_str.back() == ',') x_str.pop_back();
-
-        float x = std::stof(x_str);
-        float y = std::stof(y_str);
-        Vector2 position = {x, y};
-
-        {
-            std::lock_guard<std::mutex> lock(other_players_mutex);
-            bool was_new_player = other_players.find(client_id) == other_players.end();
-            other_players[client_id] = position;
-        }
-
-        update_enemy_position(client_id, position);
+        if (std::stoi(tokens[1]) == my_client_id) player_down = false;
     } catch (const std::exception& e) {
-        std::cerr << "Error parsing client position: " << e.what() << std::endl;
+        std::cerr << "Error parsing respawn message: " << e.what() << std::endl;
     }
 }
+
 void handle_player_event(const std::vector<std::string>& tokens) {
     if (tokens.size() < 3) return;
 
@@ -243,10 +425,6 @@ void handle_player_event(const std::vector<std::string>& tokens) {
     } else if (action == "left") {
         try {
             int client_id = std::stoi(player_id_str);
-            {
-                std::lock_guard<std::mutex> lock(other_players_mutex);
-                other_players.erase(client_id);
-            }
             remove_enemy_for_player(client_id);
             std::cout << "Player " << player_id_str << " left the game" << std::endl;
         } catch (const std::exception& e) {
@@ -298,15 +476,63 @@ void handle_game_restart(const std::vector<std::string>& tokens) {
     // reset everything for new game
     player_score = 0;
     enemy_score = 0;
-    bullets.clear();
-    enemies.clear();
+    {
+        std::lock_guard<std::mutex> lock(bullets_mutex);
+        bullets.clear();
+        predicted_bullets.clear();
+    }
+    // other players stay, the next snapshots keep moving them
     game_state = GameState::Ongoing;
     waiting_for_restart = false;
+    player_down = false;
     scoreboard_fx_time = 0;
     
     std::cout << "Game restarted! All players were ready." << std::endl;
 }
 
+// echo the server's stamp right away so the server can time the round trip
+void handle_ping(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 4) return;
+    uint64_t client_us = client_now_us();
+    send_to_server("Pong " + tokens[1] + " " + tokens[2] + " " + std::to_string(client_us) + "\n");
+    try {
+        uint64_t rtt_us = std::stoull(tokens[3]);
+        rtt_ms = static_cast<int>(rtt_us / 1000);
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        clock_offset.on_ping(std::stoull(tokens[2]), rtt_us, client_us);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing ping: " << e.what() << std::endl;
+    }
+}
+
+// stamps of a shot whose bullets arrive in the next snapshot
+void handle_latency(const std::vector<std::string>& tokens) {
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    if (!clock_offset.ready()) return; // can't place our own stamps on the server clock yet
+    latency_tracker.on_lat(tokens, my_client_id, clock_offset.to_server(client_now_us()));
+}
+
+// the server refused one of our shots (cooldown, or we were down), drop its prediction
+void handle_reject(const std::vector<std::string>& tokens) {
+    if (tokens.size() < 2) return;
+    try {
+        uint32_t seq = static_cast<uint32_t>(std::stoul(tokens[1]));
+        std::lock_guard<std::mutex> lock(bullets_mutex);
+        predicted_bullets.erase(std::remove_if(predicted_bullets.begin(), predicted_bullets.end(),
+            [seq](const Bullet& b) { return b.seq == seq; }), predicted_bullets.end());
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing reject: " << e.what() << std::endl;
+    }
+}
+
+void handle_full() {
+    std::cerr << "No game server available for this match, try again later" << std::endl;
+}
+
+void handle_no_match() {
+    std::cerr << "That match isn't running, nothing to spectate" << std::endl;
+}
+
 void parse_server_message(const std::string& message) {
     std::vector<std::string> tokens = split_by_space(message);
     if (tokens.empty()) return;
@@ -314,24 +540,60 @@ void parse_server_message(const std::string& message) {
     const std::string& type = tokens[0];
 
     if (type == "Client_ID")         return handle_client_id(tokens);
-    else if (type == "BulletsStart") return handle_bullets_start();  
-    else if (type == "Bullet")       return handle_bullet_update(tokens);
+    else if (type == "Arena")        return handle_arena(tokens);
+    else if (type == "Map")          return handle_map(tokens);
+    else if (type == "Ping")         return handle_ping(tokens);
+    else if (type == "Lat")          return handle_latency(tokens);
+    else if (type == "Reject")       return handle_reject(tokens);
+    else if (type == "Full")         return handle_full();
+    else if (type == "NoMatch")      return handle_no_match();
+    else if (type == "Snap")         return handle_snapshot_begin(tokens);
+    else if (type == "B" || type == "b" || type == "-B") return handle_snapshot_bullet(tokens);
+    else if (type == "P" || type == "-P") return handle_snapshot_player(tokens);
+    else if (type == "SnapEnd")      return handle_snapshot_end();
     else if (type == "Hit")          return handle_hit(tokens);
+    else if (type == "Respawn")      return handle_respawn(tokens);
     else if (type == "Score")        return handle_score_update(tokens);
     else if (type == "Win")          return handle_win(tokens);
     else if (type == "GameRestart")  return handle_game_restart(tokens);
-    else if (type == "Client")       return handle_client_position(tokens);
     else if (type == "Player")       return handle_player_event(tokens);
 }
 
+// writes the last `seconds` of frame traces next to us, off the render thread
+void write_trace(double seconds) {
+    std::string path = "komi-trace-" + std::to_string(getpid()) + ".json";
+    std::string error;
+    if (trace_write_json(path, seconds, error)) std::cout << "Wrote trace " << path << std::endl;
+    else std::cerr << "Trace dump failed: " << error << std::endl;
+}
+
+// the network thread: every line the server sends
+void read_server(tcp::socket& socket) {
+    trace_set_thread_name("network");
+    try {
+        boost::asio::streambuf buf;
+        while (true) {
+            boost::asio::read_until(socket, buf, "\n");
+            std::istream is(&buf);
+            std::string line;
+            std::getline(is, line);
+            parse_server_message(line);
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Server read error: " << e.what() << std::endl;
+    }
+}
+
 void draw_weapons_selection() {
-    std::string pistol_text = "1. pistol";
-    std::string shotgun_text = "2. shotgun";
+    const char* pistol_text = "1. pistol";
+    const char* shotgun_text = "2. shotgun";
+    const int pistol = find_weapon("pistol");
+    const int shotgun = find_weapon("shotgun");
     int pistol_font = 20;
     int shotgun_font = 20;
-    if (selected_weapon == "pistol") {
+    if (selected_weapon == pistol) {
       pistol_font = 23;
-    }else if (selected_weapon == "shotgun") {
+    }else if (selected_weapon == shotgun) {
       shotgun_font = 23;
     }
 
@@ -342,8 +604,8 @@ void draw_weapons_selection() {
 
     // measure maximum line width
     int maxLineWidth = std::max(
-        MeasureText(pistol_text.c_str(), pistol_font),
-        MeasureText(shotgun_text.c_str(), shotgun_font)
+        MeasureText(pistol_text, pistol_font),
+        MeasureText(shotgun_text, shotgun_font)
     );
 
     int rectWidth = maxLineWidth + 2 * padding;
@@ -362,17 +624,32 @@ void draw_weapons_selection() {
     const Color COLOR_UNSELECTED = { 220, 220, 220, 255 };
 
     // draw each line of text
-    if (selected_weapon == "pistol") {
-      DrawText(pistol_text.c_str(), rectX + padding, rectY + padding, pistol_font, COLOR_SELECTED);
-      DrawText(shotgun_text.c_str(), rectX + padding, rectY + padding + shotgun_font, shotgun_font, COLOR_UNSELECTED);
-    }else if (selected_weapon == "shotgun") {
-      DrawText(pistol_text.c_str(), rectX + padding, rectY + padding, pistol_font, COLOR_UNSELECTED);
-      DrawText(shotgun_text.c_str(), rectX + padding, rectY + padding + shotgun_font, shotgun_font+2, COLOR_SELECTED);
+    if (selected_weapon == pistol) {
+      DrawText(pistol_text, rectX + padding, rectY + padding, pistol_font, COLOR_SELECTED);
+      DrawText(shotgun_text, rectX + padding, rectY + padding + shotgun_font, shotgun_font, COLOR_UNSELECTED);
+    }else if (selected_weapon == shotgun) {
+      DrawText(pistol_text, rectX + padding, rectY + padding, pistol_font, COLOR_UNSELECTED);
+      DrawText(shotgun_text, rectX + padding, rectY + padding + shotgun_font, shotgun_font+2, COLOR_SELECTED);
+    }
+}
+// draws the wall tiles the camera can see
+void draw_walls(const Camera2D& camera) {
+    if (!game_map.loaded()) return;
+    int ts = game_map.tile_size();
+    int c0 = static_cast<int>((camera.target.x - camera.offset.x) / ts);
+    int r0 = static_cast<int>((camera.target.y - camera.offset.y) / ts);
+    int c1 = c0 + screenWidth / ts + 1;
+    int r1 = r0 + screenHeight / ts + 1;
+    for (int r = std::max(r0, 0); r <= std::min(r1, game_map.rows() - 1); r++) {
+        for (int c = std::max(c0, 0); c <= std::min(c1, game_map.cols() - 1); c++) {
+            if (game_map.solid_tile(c, r)) DrawRectangle(c * ts, r * ts, ts, ts, DARKGRAY);
+        }
     }
 }
+
 void draw_scoreboard() {
-    std::string scoreboard = std::to_string(player_score) + " | " + std::to_string(enemy_score);
-    const char* scoreboard_text = scoreboard.c_str();
+    char scoreboard_text[32];
+    snprintf(scoreboard_text, sizeof(scoreboard_text), "%d | %d", player_score, enemy_score);
     int textWidth = MeasureText(scoreboard_text, 20);
     int rectWidth = textWidth + 40;
     int rectHeight = 40;
@@ -397,39 +674,230 @@ float get_mouse_angle(float circleX, float circleY, Vector2 mousePos) {
   if (angleDegrees <= 0) {
     angleDegrees += 360.0;
   }
-  float slope = y/x; // rise / run
-  
-  std::cout << "Angle: " << angleDegrees << std::endl;
   return angleDegrees;
 }
 
-int main() {
+// the parts of a frame that don't need a window, shared by the game loop and --alloc-check
+
+// one axis at a time, so we slide along walls instead of sticking to them
+void move_player(float& x, float& y, float dx, float dy, float radius, float speed, float dt) {
+    float len = std::sqrt(dx*dx + dy*dy);
+    if (len > 0.0f) {
+        dx /= len;
+        dy /= len;
+    }
+    float next_x = x + dx * speed * dt;
+    if (!game_map.circle_hits_wall(next_x, y, radius)) x = next_x;
+    float next_y = y + dy * speed * dt;
+    if (!game_map.circle_hits_wall(x, next_y, radius)) y = next_y;
+}
+
+// our shot shows up right away, the server confirms it with the same seq
+void fire_shot(int weapon_index, float aim, float x, float y, double now, uint64_t input_us) {
+    const WeaponDef& weapon = WEAPONS[weapon_index];
+    uint32_t seq = next_shot_seq++;
+    uint32_t pellet = 0;
+    {
+        std::lock_guard<std::mutex> bullets_lock(bullets_mutex);
+        for_each_pellet(weapon, aim, [&](float vx, float vy) {
+            Bullet bullet;
+            bullet.seq = seq;
+            bullet.pellet = pellet++;
+            bullet.position = { x, y };
+            bullet.velocity = { vx, vy };
+            bullet.fired_at = now;
+            predicted_bullets.push_back(bullet);
+        });
+    }
+    send_fire(weapon_index, aim, seq, input_us);
+}
+
+// bullets fly on locally between snapshots. hits and scoring are the server's call,
+// predicted bullets only stop at walls and give up if the server never confirms them.
+void step_bullets(float dt, double now) {
+    std::lock_guard<std::mutex> bullets_lock(bullets_mutex);
+    for (auto& [id, b] : bullets) {
+        b.position.x += b.velocity.x * dt;
+        b.position.y += b.velocity.y * dt;
+    }
+    double confirm_timeout = std::max(0.5, 3.0 * rtt_ms.load() / 1000.0);
+    predicted_bullets.erase(std::remove_if(predicted_bullets.begin(), predicted_bullets.end(),
+        [&](Bullet& b) {
+            b.position.x += b.velocity.x * dt;
+            b.position.y += b.velocity.y * dt;
+            return now - b.fired_at > confirm_timeout ||
+                   b.position.x < 0 || b.position.x > arena_width ||
+                   b.position.y < 0 || b.position.y > arena_height ||
+                   game_map.solid_at(b.position.x, b.position.y);
+        }), predicted_bullets.end());
+}
+
+// measured bullets this frame draws for the first time
+void collect_first_drawn(std::vector<uint32_t>& first_drawn) {
+    std::lock_guard<std::mutex> lock(bullets_mutex);
+    for (auto& [id, b] : bullets) {
+        if (b.measured) {
+            first_drawn.push_back(id);
+            b.measured = false;
+        }
+    }
+}
+
+// the frame that drew them is on screen now
+void record_first_drawn(std::vector<uint32_t>& first_drawn) {
+    if (first_drawn.empty()) return;
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    uint64_t drawn_us = clock_offset.to_server(client_now_us());
+    for (uint32_t id : first_drawn) latency_tracker.on_drawn(id, drawn_us, latency_stats);
+    first_drawn.clear();
+}
+
+// the frame loop doesn't allocate once these have grown to size
+void reserve_frame_buffers(std::vector<uint32_t>& first_drawn) {
+    first_drawn.reserve(64);
+    {
+        std::lock_guard<std::mutex> lock(bullets_mutex);
+        predicted_bullets.reserve(64);
+    }
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    latency_stats.reserve(10000);
+}
+
+// true, after a complaint, if the frame that started at allocs_at_frame_start allocated
+bool frame_allocated(int frame, uint64_t allocs_at_frame_start) {
+    uint64_t frame_allocs = alloc_check_count() - allocs_at_frame_start;
+    if (frame <= ALLOC_WARMUP_FRAMES || frame_allocs == 0) return false;
+    fprintf(stderr, "Frame %d made %llu heap allocations\n", frame, static_cast<unsigned long long>(frame_allocs));
+    return true;
+}
+
+// --alloc-check <frames>: plays that many frames without a window against a
+// fake server on loopback that streams another player's shots, with Lat lines
+// and Pings, while we walk in circles and fire. returns 1 if a frame after the
+// warm up allocated. counts nothing unless built with -DKOMI_ALLOC_CHECK, see build.sh.
+int run_alloc_check(int frames) {
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    tcp::socket socket(io_context);
+    socket.connect(acceptor.local_endpoint());
+    tcp::socket server(io_context);
+    acceptor.accept(server);
+    global_socket = &socket;
+    std::thread reader(read_server, std::ref(socket));
+
+    // whatever we send is read and thrown away
+    std::thread sink([&server]() {
+        char buf[4096];
+        boost::system::error_code ec;
+        while (!ec) server.read_some(boost::asio::buffer(buf), ec);
+    });
+
+    std::atomic<bool> done{false};
+    std::thread fake_server([&server, &done]() {
+        const int other = 2;
+        const uint32_t lifetime = 60; // ticks
+        std::string out = "Client_ID 1\nArena 3840 2160\n";
+        boost::system::error_code ec;
+        for (uint32_t tick = 1; !done && !ec; tick++) {
+            unsigned long long now = client_now_us(); // the fake server's clock
+            if (tick % 30 == 1) append_line(out, "Ping %u %llu 20000\n", tick, now);
+            // one shot every 10 ticks, bullet id = the tick it was fired
+            if (tick % 10 == 0) {
+                unsigned long long stamp = now - 30000;
+                append_line(out, "Lat %u 1 %d %llu %llu %llu %llu %llu\n", tick, other,
+                            stamp, stamp + 1000, stamp + 11000, now, now);
+            }
+            append_line(out, "Snap %u 0\n", tick);
+            for (uint32_t id = tick / 10 * 10; id > 0 && id + lifetime > tick; id -= 10) {
+                float travel = (tick - id) * 10.0f;
+                append_line(out, "B %u %.1f 500.0 600.0 0.0 %d 0 0\n", id, 500.0f + travel, other);
+            }
+            append_line(out, "P %d 500.0 500.0\nSnapEnd\n", other);
+            boost::asio::write(server, boost::asio::buffer(out), ec);
+            out.clear();
+            std::this_thread::sleep_for(std::chrono::microseconds(16667));
+        }
+    });
+
+    float x = 1920.0f, y = 1080.0f;
+    std::vector<uint32_t> first_drawn;
+    reserve_frame_buffers(first_drawn);
+    int allocating_frames = 0;
+    for (int frame = 1; frame <= frames; frame++) {
+        uint64_t input_us = client_now_us();
+        uint64_t allocs_at_frame_start = alloc_check_count();
+        const float dt = 1.0f / 240.0f;
+        double now = input_us / 1e6;
+
+        float angle = frame * 0.01f;
+        move_player(x, y, std::cos(angle), std::sin(angle), 15.0f, 400.0f, dt);
+        if (player_id_received) send_player_position(x, y);
+        if (frame % 30 == 0) {
+            int weapon_index = find_weapon(frame % 60 == 0 ? "shotgun" : "pistol");
+            fire_shot(weapon_index, direction_to_degrees(Direction::Up), x, y, now, input_us);
+        }
+        step_bullets(dt, now);
+        collect_first_drawn(first_drawn);
+        record_first_drawn(first_drawn);
+
+        if (frame_allocated(frame, allocs_at_frame_start)) allocating_frames++;
+        std::this_thread::sleep_for(std::chrono::microseconds(4167));
+    }
+    done = true;
+    fake_server.join();
+    {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        boost::system::error_code ignored;
+        server.shutdown(tcp::socket::shutdown_send, ignored);
+        socket.shutdown(tcp::socket::shutdown_send, ignored);
+        global_socket = nullptr;
+    }
+    reader.join();
+    sink.join();
+
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    std::cout << frames << " frames, " << allocating_frames << " allocated, "
+              << latency_stats.count() << " shots measured" << std::endl;
+    return allocating_frames == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    // komi [host] [port] [match] [--spectate] [--measure], host and port can be a
+    // gateway, a single server or, for spectators, a komi_relay
+    bool spectating = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--spectate") spectating = true;
+        else if (std::string(argv[i]) == "--measure") measure_latency = true;
+        else if (std::string(argv[i]) == "--alloc-check" && i + 1 < argc) {
+            measure_latency = true;
+            return run_alloc_check(std::atoi(argv[++i]));
+        }
+        else args.push_back(argv[i]);
+    }
+    std::string host  = args.size() > 0 ? args[0] : "192.168.1.79";
+    std::string port  = args.size() > 1 ? args[1] : "8080";
+    std::string match = args.size() > 2 ? args[2] : "default";
 
     boost::asio::io_context io_context;
     tcp::resolver resolver(io_context);
-    auto endpoints = resolver.resolve("192.168.1.79", "8080");
+    auto endpoints = resolver.resolve(host, port);
     tcp::socket socket(io_context);
 
     try {
         boost::asio::connect(socket, endpoints);
         global_socket = &socket;
 
+        // the gateway routes us by the first line
+        send_to_server((spectating ? "Spectate " : "Join ") + match + "\n");
+
         // spawn thread to read from server
-        std::thread reader_thread([&socket]() {
-            try {
-                boost::asio::streambuf buf;
-                while (true) {
-                    boost::asio::read_until(socket, buf, "\n");
-                    std::istream is(&buf);
-                    std::string line;
-                    std::getline(is, line);
-                    parse_server_message(line);
-                }
-            } catch (std::exception& e) {
-                std::cerr << "Server read error: " << e.what() << std::endl;
-            }
-        });
-        reader_thread.detach();
+        std::thread(read_server, std::ref(socket)).detach();
+
+        // the server only sends what fits on our screen, plus a margin.
+        // spectators always get the whole arena.
+        if (!spectating) send_to_server("Viewport " + std::to_string(screenWidth) + " " + std::to_string(screenHeight) + "\n");
+        if (!spectating && measure_latency) send_to_server("Measure\n");
 
     } catch (std::exception& e) {
         std::cerr << "Connection failed: " << e.what() << std::endl;
@@ -443,62 +911,112 @@ int main() {
     const float playerRadius = 15.0f;
     const float playerSpeed  = 400.0f;
 
-    const int WINNING_SCORE = 10;
+    double next_fire_time = 0.0;
+
+    // world is drawn through a camera that follows the player
+    Camera2D camera = {};
+    camera.offset = { screenWidth / 2.0f, screenHeight / 2.0f };
+    camera.zoom = 1.0f;
+
+    trace_set_thread_name("main");
+    std::signal(SIGUSR2, [](int) { trace_dump_requested = true; });
+
+    std::vector<uint32_t> first_drawn; // bullets first drawn this frame whose latency is measured
+    reserve_frame_buffers(first_drawn);
+    int frames = 0;
+    std::string map_error; // set if our copy of the server's map is missing or differs
+    int exit_code = 0;
 
     while (!WindowShouldClose()) {
+        TRACE_MARK(frame_start);
+        uint64_t input_us = client_now_us(); // EndDrawing just polled the keys
         float dt = GetFrameTime();
 
-        // handle restart
-        if (game_state != GameState::Ongoing && IsKeyPressed(KEY_R)) {
-            player_score = 0;
-            enemy_score = 0;
-            bullets.clear();
-            enemies.clear();
-            game_state = GameState::Ongoing;
-            continue;
+        if (trace_dump_requested.exchange(false)) {
+            std::thread(write_trace, TRACE_DUMP_SECONDS).detach();
+        }
+        uint64_t allocs_at_frame_start = alloc_check_count(); // starting a trace dump allocates, nothing after it
+
+        // spawn in the middle of the arena once we know its size
+        {
+            std::lock_guard<std::mutex> lock(arena_mutex);
+            if (arena_received) {
+                circleX = arena_width / 2.0f;
+                circleY = arena_height / 2.0f;
+                arena_received = false;
+            }
+            if (!pending_map.empty()) {
+                std::string path = "maps/" + pending_map;
+                if (!game_map.open(path, map_error)) {
+                    map_error = "the server plays " + pending_map + " but " + map_error;
+                } else if (pending_map_size != 0 && (game_map.file_size() != pending_map_size ||
+                                                     game_map.checksum() != pending_map_checksum)) {
+                    map_error = path + " differs from the server's copy";
+                    game_map.close();
+                }
+                pending_map.clear();
+            }
+            if (!pending_map_error.empty()) map_error = pending_map_error;
+        }
+        // without the server's walls we'd walk and shoot through them, so don't play at all
+        if (!map_error.empty()) {
+            std::cerr << "Can't play: " << map_error << std::endl;
+            exit_code = 1;
+            break;
+        }
+
+        // spectators only fly the camera around, nothing is sent back
+        if (spectating) {
+            const float cameraSpeed = 900.0f;
+            if (IsKeyDown(KEY_W)) circleY -= cameraSpeed * dt;
+            if (IsKeyDown(KEY_S)) circleY += cameraSpeed * dt;
+            if (IsKeyDown(KEY_A)) circleX -= cameraSpeed * dt;
+            if (IsKeyDown(KEY_D)) circleX += cameraSpeed * dt;
+            circleX = std::clamp(circleX, 0.0f, arena_width);
+            circleY = std::clamp(circleY, 0.0f, arena_height);
         }
 
-        // Check win/lose conditions
-        if (game_state == GameState::Ongoing) {
-            if (player_score >= WINNING_SCORE) game_state = GameState::Win;
-            if (enemy_score >= WINNING_SCORE) game_state = GameState::Lose;
+        // handle restart, the server starts the next game once everyone is ready
+        if (!spectating && game_state != GameState::Ongoing && !waiting_for_restart && IsKeyPressed(KEY_R)) {
+            send_to_server("Restart\n");
+            waiting_for_restart = true;
         }
 
-        if (game_state == GameState::Ongoing) {
+        if (!spectating && game_state == GameState::Ongoing) {
             float dx = 0, dy = 0;
 
             if (IsKeyDown(KEY_W) && circleY - playerRadius > 0) dy = -1;
-            if (IsKeyDown(KEY_S) && circleY + playerRadius < screenHeight) dy =  1;
+            if (IsKeyDown(KEY_S) && circleY + playerRadius < arena_height) dy =  1;
             if (IsKeyDown(KEY_A) && circleX - playerRadius > 0) dx = -1;
-            if (IsKeyDown(KEY_D) && circleX + playerRadius < screenWidth) dx =  1;
+            if (IsKeyDown(KEY_D) && circleX + playerRadius < arena_width) dx =  1;
 
             // update facing direction
             if (IsKeyDown(KEY_W) && IsKeyDown(KEY_D)) {
-                direction = "top_right";
+                direction = Direction::TopRight;
             }
             else if (IsKeyDown(KEY_W) && IsKeyDown(KEY_A)) {
-                direction = "top_left";
+                direction = Direction::TopLeft;
             }
             else if (IsKeyDown(KEY_S) && IsKeyDown(KEY_D)) {
-                direction = "bottom_right";
+                direction = Direction::BottomRight;
             }
             else if (IsKeyDown(KEY_S) && IsKeyDown(KEY_A)) {
-                direction = "bottom_left";
+                direction = Direction::BottomLeft;
             }
             else if (IsKeyDown(KEY_W)) {
-                direction = "up";
+                direction = Direction::Up;
                 latest_right_direction = direction;
             }
             else if (IsKeyDown(KEY_S)) {
-                direction = "down";
+                direction = Direction::Down;
                 latest_right_direction = direction;
             }
             else if (IsKeyDown(KEY_A)) {
-                direction = "left";
+                direction = Direction::Left;
                 latest_right_direction = direction;
             }
             else if (IsKeyDown(KEY_D)) {
-                direction = "right";
+                direction = Direction::Right;
                 latest_right_direction = direction;
             }
 
@@ -512,117 +1030,83 @@ int main() {
                 direction = latest_right_direction;
             }
 
-            // move player
-            float len = std::sqrt(dx*dx + dy*dy);
-            if (len > 0.0f) {
-                dx /= len;
-                dy /= len;
-            }
-            circleX += dx * playerSpeed * dt;
-            circleY += dy * playerSpeed * dt;
+            move_player(circleX, circleY, dx, dy, playerRadius, playerSpeed, dt);
 
             if (player_id_received) {
                 send_player_position(circleX, circleY);
             }
 
-            if (IsKeyPressed(KEY_ONE)) selected_weapon = "pistol";
-            if (IsKeyPressed(KEY_TWO)) selected_weapon = "shotgun";
+            if (IsKeyPressed(KEY_ONE)) selected_weapon = find_weapon("pistol");
+            if (IsKeyPressed(KEY_TWO)) selected_weapon = find_weapon("shotgun");
 
-            if (IsKeyPressed(KEY_SPACE)) {
-                bullets.push_back({ {circleX, circleY}, 600.0f, direction });
-                Bullet bullet{ {circleX, circleY}, 600.0f, direction };
-                send_bullet_position(bullet);
+            int weapon_index = selected_weapon;
+            if (IsKeyPressed(KEY_SPACE) && weapon_index >= 0 && !player_down && GetTime() >= next_fire_time) {
+                fire_shot(weapon_index, direction_to_degrees(direction), circleX, circleY, GetTime(), input_us);
+                next_fire_time = GetTime() + WEAPONS[weapon_index].cooldown;
             }
-
-            if (IsKeyPressed(KEY_V)) {
-                enemies.push_back({ {circleX, circleY}, 10.0f, -1 });
-            }
-
-            // update bullets
-            for (auto& b : bullets) {
-                if (b.direction == "top_right")      { b.position.x += b.speed * dt; b.position.y -= b.speed * dt; }
-                else if (b.direction == "top_left")  { b.position.x -= b.speed * dt; b.position.y -= b.speed * dt; }
-                else if (b.direction == "bottom_right") { b.position.x += b.speed * dt; b.position.y += b.speed * dt; }
-                else if (b.direction == "bottom_left")  { b.position.x -= b.speed * dt; b.position.y += b.speed * dt; }
-                else if (b.direction == "up")        b.position.y -= b.speed * dt;
-                else if (b.direction == "down")      b.position.y += b.speed * dt;
-                else if (b.direction == "left")      b.position.x -= b.speed * dt;
-                else if (b.direction == "right")     b.position.x += b.speed * dt;
-            }
-
-            // bullet collisions
-            for (auto bIt = bullets.begin(); bIt != bullets.end(); ) {
-                bool removedBullet = false;
-
-                {
-                    std::lock_guard<std::mutex> lock(enemies_mutex);
-                    for (auto eIt = enemies.begin(); eIt != enemies.end(); ) {
-                        if (CheckCollisionCircles(bIt->position, Bullet::RADIUS,
-                                                  eIt->position, Enemy::RADIUS)) {
-                            std::cout << "Hit enemy (player " << eIt->client_id << ")!" << std::endl;
-                            eIt = enemies.erase(eIt);
-                            bIt = bullets.erase(bIt);
-                            removedBullet = true;
-
-                            scoreboard_fx_time = 10;
-                            player_score++;
-                            send_to_server("Bullet has taken out enemy!\n");
-                            break;
-                        } else {
-                            ++eIt;
-                        }
-                    }
-                }
-
-                if (!removedBullet) ++bIt;
-            }
-
-            bullets.erase(std::remove_if(bullets.begin(), bullets.end(),
-                [&](const Bullet& b){
-                    return b.position.x < 0 || b.position.x > screenWidth ||
-                           b.position.y < 0 || b.position.y > screenHeight;
-                }), bullets.end());
         }
 
+        step_bullets(dt, GetTime());
+
         // DRAWING
+        TRACE_MARK(draw_start);
+        TRACE_SPAN("simulate", frame_start, draw_start);
+        if (spectating || game_state == GameState::Ongoing) collect_first_drawn(first_drawn); // the world is drawn
+        camera.target = { circleX, circleY };
         BeginDrawing();
         ClearBackground(BLACK);
 
-        draw_scoreboard();
-        draw_weapons_selection();
-
-        if (game_state == GameState::Win) {
+        if (!spectating && game_state == GameState::Win) {
             DrawText("YOU WIN!", screenWidth/2 - MeasureText("YOU WIN!", 60)/2, screenHeight/2 - 30, 60, GREEN);
-            DrawText("Press [R] to restart", screenWidth/2 - MeasureText("Press [R] to restart", 20)/2, screenHeight/2 + 40, 20, GRAY);
-        } else if (game_state == GameState::Lose) {
+            const char* restart_text = waiting_for_restart ? "Waiting for other players..." : "Press [R] to restart";
+            DrawText(restart_text, screenWidth/2 - MeasureText(restart_text, 20)/2, screenHeight/2 + 40, 20, GRAY);
+        } else if (!spectating && game_state == GameState::Lose) {
             DrawText("YOU LOSE!", screenWidth/2 - MeasureText("YOU LOSE!", 60)/2, screenHeight/2 - 30, 60, RED);
-            DrawText("Press [R] to restart", screenWidth/2 - MeasureText("Press [R] to restart", 20)/2, screenHeight/2 + 40, 20, GRAY);
+            const char* restart_text = waiting_for_restart ? "Waiting for other players..." : "Press [R] to restart";
+            DrawText(restart_text, screenWidth/2 - MeasureText(restart_text, 20)/2, screenHeight/2 + 40, 20, GRAY);
         } else {
-            DrawCircleV({circleX, circleY}, playerRadius, WHITE);
+            BeginMode2D(camera);
+            DrawRectangleLines(0, 0, static_cast<int>(arena_width), static_cast<int>(arena_height), DARKGRAY);
+            draw_walls(camera);
+            if (!spectating) DrawCircleV({circleX, circleY}, playerRadius, player_down ? DARKGRAY : WHITE);
 
             {
-                std::lock_guard<std::mutex> lock(other_players_mutex);
-                for (const auto& player : other_players) {
-                    DrawCircleV(player.second, playerRadius, RED);
-                }
+                std::lock_guard<std::mutex> lock(enemies_mutex);
+                for (const Enemy& e : enemies) DrawCircleV(e.position, Enemy::RADIUS, RED);
             }
 
-            for (const auto& b : bullets) DrawCircleV(b.position, Bullet::RADIUS, PINK);
             {
-                std::lock_guard<std::mutex> lock(enemies_mutex);
-                for (const auto& e : enemies) {
-                    DrawCircleV(e.position, Enemy::RADIUS, ORANGE);
-                }
+                std::lock_guard<std::mutex> lock(bullets_mutex);
+                for (const auto& [id, b] : bullets) DrawCircleV(b.position, Bullet::RADIUS, PINK);
+                for (const auto& b : predicted_bullets) DrawCircleV(b.position, Bullet::RADIUS, PINK);
             }
 
-            Vector2 mousePos = GetMousePosition();
+            EndMode2D();
+
+            Vector2 mousePos = GetScreenToWorld2D(GetMousePosition(), camera);
             get_mouse_angle(circleX, circleY, mousePos);
         }
 
-        EndDrawing();
+        // HUD in screen space, on top of the world
+        draw_scoreboard();
+        DrawText(TextFormat("%d ms", rtt_ms.load()), screenWidth - 80, 10, 20, GRAY);
+        if (spectating) DrawText("SPECTATING", 10, screenHeight - 30, 20, GRAY);
+        else draw_weapons_selection();
+
+        EndDrawing(); // also waits out the rest of the frame
+        TRACE_MARK(draw_end);
+        TRACE_SPAN("draw", draw_start, draw_end);
+
+        record_first_drawn(first_drawn);
+
+        if (frame_allocated(++frames, allocs_at_frame_start)) std::abort();
     }
 
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex);
+        if (latency_stats.count() > 0) std::cout << "Input to display latency of other players' shots\n" << latency_stats.report();
+    }
     CloseWindow();
-    return 0;
+    return exit_code;
 }
 
@@ -0,0 +1,330 @@
+// komi bot: headless players for load and latency tests.
+//
+// each bot joins a match, wanders around the middle of the arena and fires a
+// pistol on cooldown, with latency stamps on every shot. it decodes snapshots
+// like komi does and "draws" at 60 fps, so the other bots' shots are measured
+// from input to the frame that would show them. on exit it prints the
+// percentiles of every leg of that chain (see latency.hpp) over all bots.
+//
+// bots shoot at the nearest other player where their last snapshot shows it,
+// so the share of shots the server counts as hits says how much a stale view
+// costs. behind komi_netem that is the hit registration of a real network.
+//
+//   ./komi_bot --server 127.0.0.1:8080 --match default --bots 8 --seconds 30
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "latency.hpp"
+#include "snapshot.hpp"
+#include "weapons.hpp"
+
+using boost::asio::ip::tcp;
+
+const float FRAME_RATE = 60.0f;
+const float BOT_SPEED = 200.0f;     // pixels per second
+const float WANDER_RADIUS = 300.0f; // bots stay this close to the middle so they see each other
+const float AIM_RANGE = 400.0f;     // only players this close are shot at
+
+const auto start_time = std::chrono::steady_clock::now();
+
+// every bot's samples end up here
+LatencyStats all_stats;
+std::mutex all_stats_mutex;
+std::atomic<int> total_shots{0};
+std::atomic<int> total_hits{0};
+
+uint64_t local_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+}
+
+std::vector<std::string> split_by_space(const std::string& input) {
+    std::istringstream iss(input);
+    std::string word;
+    std::vector<std::string> words;
+
+    while (iss >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+class Bot {
+public:
+    Bot(boost::asio::io_context& io_context, int index) : socket(io_context), rng(index * 7919 + 1) {}
+
+    void run(const tcp::endpoint& server, const std::string& match, double seconds) {
+        try {
+            socket.connect(server);
+            socket.set_option(tcp::no_delay(true));
+            send("Join " + match + "\n");
+            send("Viewport 1280 720\n");
+            send("Measure\n");
+            std::thread reader([this] { read_loop(); });
+            play(seconds);
+            boost::system::error_code ignored;
+            socket.shutdown(tcp::socket::shutdown_both, ignored);
+            reader.join();
+        } catch (const std::exception& e) {
+            std::cerr << "Bot error: " << e.what() << std::endl;
+        }
+    }
+
+private:
+    void send(const std::string& msg) {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        boost::asio::write(socket, boost::asio::buffer(msg));
+    }
+
+    void read_loop() {
+        boost::asio::streambuf buf;
+        try {
+            while (true) {
+                boost::asio::read_until(socket, buf, "\n");
+                std::istream is(&buf);
+                std::string line;
+                std::getline(is, line);
+                handle_line(split_by_space(line));
+            }
+        } catch (const std::exception&) {
+            // the connection closed, run() is finishing up
+        }
+    }
+
+    void handle_line(const std::vector<std::string>& tokens) {
+        if (tokens.empty()) return;
+        const std::string& type = tokens[0];
+        try {
+            if (type == "Client_ID" && tokens.size() >= 2) {
+                client_id = std::stoi(tokens[1]);
+            } else if (type == "Arena" && tokens.size() >= 3) {
+                arena_width = std::stof(tokens[1]);
+                arena_height = std::stof(tokens[2]);
+            } else if (type == "Ping" && tokens.size() >= 4) {
+                uint64_t now = local_now_us();
+                send("Pong " + tokens[1] + " " + tokens[2] + " " + std::to_string(now) + "\n");
+                std::lock_guard<std::mutex> lock(mutex);
+                clock.on_ping(std::stoull(tokens[2]), std::stoull(tokens[3]), now);
+            } else if (type == "Lat") {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (clock.ready()) tracker.on_lat(tokens, client_id, clock.to_server(local_now_us()));
+            } else if (type == "Snap" && tokens.size() >= 3) {
+                if (!decoder.begin(static_cast<uint32_t>(std::stoul(tokens[1])),
+                                   static_cast<uint32_t>(std::stoul(tokens[2])), history)) {
+                    send("Resync\n");
+                }
+            } else if (type == "B" && tokens.size() >= 9) {
+                decoder.bullet_added({static_cast<uint32_t>(std::stoul(tokens[1])), std::stof(tokens[2]),
+                                      std::stof(tokens[3]), std::stof(tokens[4]), std::stof(tokens[5]),
+                                      std::stoi(tokens[6]), static_cast<uint32_t>(std::stoul(tokens[7])),
+                                      static_cast<uint32_t>(std::stoul(tokens[8]))});
+            } else if (type == "b" && tokens.size() >= 4) {
+                decoder.bullet_moved(static_cast<uint32_t>(std::stoul(tokens[1])), std::stof(tokens[2]), std::stof(tokens[3]));
+            } else if (type == "-B" && tokens.size() >= 2) {
+                decoder.bullet_removed(static_cast<uint32_t>(std::stoul(tokens[1])));
+            } else if (type == "P" && tokens.size() >= 4) {
+                decoder.player_updated({std::stoi(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])});
+            } else if (type == "-P" && tokens.size() >= 2) {
+                decoder.player_removed(std::stoi(tokens[1]));
+            } else if (type == "SnapEnd") {
+                apply_snapshot();
+            } else if (type == "Hit" && tokens.size() >= 3) {
+                if (std::stoi(tokens[1]) == client_id) total_hits++;
+                std::lock_guard<std::mutex> lock(mutex);
+                respawning.insert(std::stoi(tokens[2]));
+            } else if (type == "Respawn" && tokens.size() >= 2) {
+                std::lock_guard<std::mutex> lock(mutex);
+                respawning.erase(std::stoi(tokens[1]));
+            } else if (type == "Win") {
+                send("Restart\n"); // keep playing, the next game starts once every bot agrees
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Bot " << client_id << " bad line " << type << ": " << e.what() << std::endl;
+        }
+    }
+
+    // bullets not in the previous snapshot are new. the ones being measured
+    // are drawn on the next frame.
+    void apply_snapshot() {
+        const WorldSnapshot* snap = decoder.end();
+        if (!snap) return;
+        history.push(*snap);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t received_us = clock.to_server(local_now_us());
+            for (const BulletState& bullet : snap->bullets) {
+                if (std::binary_search(known_bullets.begin(), known_bullets.end(), bullet.id)) continue;
+                if (tracker.on_received(bullet.id, received_us)) to_draw.push_back(bullet.id);
+            }
+            known_bullets.clear();
+            for (const BulletState& bullet : snap->bullets) known_bullets.push_back(bullet.id);
+            others.clear();
+            for (const PlayerState& player : snap->players) {
+                if (player.id != client_id) others.push_back(player);
+            }
+        }
+        send("Ack " + std::to_string(snap->tick) + "\n");
+    }
+
+    // aim in degrees at the nearest other player in range, as of the last snapshot.
+    // nobody shoots or is shot at while respawning, the server would ignore it.
+    bool find_target(float x, float y, float& aim) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (respawning.count(client_id)) return false;
+        float best = AIM_RANGE;
+        bool found = false;
+        for (const PlayerState& player : others) {
+            if (respawning.count(player.id)) continue;
+            float distance = std::hypot(player.x - x, player.y - y);
+            if (distance < best) {
+                best = distance;
+                aim = std::atan2(-(player.y - y), player.x - x) * 180.0f / static_cast<float>(M_PI);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void play(double seconds) {
+        const auto frame = std::chrono::microseconds(static_cast<int64_t>(1e6f / FRAME_RATE));
+        const float dt = 1.0f / FRAME_RATE;
+        const int pistol = find_weapon("pistol");
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float heading = unit(rng) * 360.0f;
+        float x = 0.0f, y = 0.0f;
+        bool placed = false;
+        uint32_t shot_seq = 1;
+        double next_fire = 0.0;
+        // the arena size comes right after our id
+        while (client_id < 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto next_frame = std::chrono::steady_clock::now();
+        auto stop_at = next_frame + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(seconds));
+
+        while (std::chrono::steady_clock::now() < stop_at) {
+            uint64_t input_us = local_now_us();
+            float cx = arena_width / 2.0f, cy = arena_height / 2.0f;
+            if (!placed) {
+                x = cx + (unit(rng) - 0.5f) * WANDER_RADIUS;
+                y = cy + (unit(rng) - 0.5f) * WANDER_RADIUS;
+                placed = true;
+            }
+
+            // wander, turning back towards the middle when too far out
+            heading += (unit(rng) - 0.5f) * 30.0f;
+            if (std::hypot(x - cx, y - cy) > WANDER_RADIUS) {
+                heading = std::atan2(-(cy - y), cx - x) * 180.0f / static_cast<float>(M_PI);
+            }
+            float radians = heading * static_cast<float>(M_PI) / 180.0f;
+            x += std::cos(radians) * BOT_SPEED * dt;
+            y -= std::sin(radians) * BOT_SPEED * dt;
+            send("Position " + std::to_string(x) + ", " + std::to_string(y) + "\n");
+
+            double now_s = input_us / 1e6;
+            float aim = 0.0f;
+            if (now_s >= next_fire && find_target(x, y, aim)) {
+                next_fire = now_s + WEAPONS[pistol].cooldown;
+                total_shots++;
+                std::string msg = "Fire " + std::to_string(pistol) + " " + std::to_string(aim) + " " +
+                                  std::to_string(shot_seq++);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (clock.ready()) {
+                        msg += " " + std::to_string(clock.to_server(input_us)) + " " +
+                               std::to_string(clock.to_server(local_now_us()));
+                    }
+                }
+                send(msg + "\n");
+            }
+
+            // the frame is "shown" once the frame time is up
+            next_frame += frame;
+            std::this_thread::sleep_until(next_frame);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                uint64_t drawn_us = clock.to_server(local_now_us());
+                for (uint32_t id : to_draw) tracker.on_drawn(id, drawn_us, stats);
+                to_draw.clear();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::lock_guard<std::mutex> all_lock(all_stats_mutex);
+        all_stats.merge(stats);
+    }
+
+    tcp::socket socket;
+    std::mutex send_mutex;
+    std::mt19937 rng;
+
+    // written by the reader before play() needs them, good enough for a test tool
+    std::atomic<int> client_id{-1};
+    std::atomic<float> arena_width{3840.0f};
+    std::atomic<float> arena_height{2160.0f};
+
+    // reader thread only
+    SnapshotHistory history;
+    SnapshotDecoder decoder;
+
+    // shared by the reader and play()
+    std::mutex mutex;
+    ClockOffset clock;
+    LatencyTracker tracker;
+    LatencyStats stats;
+    std::vector<uint32_t> known_bullets; // ids in the last snapshot, sorted
+    std::vector<uint32_t> to_draw;
+    std::vector<PlayerState> others; // everyone else in the last snapshot
+    std::unordered_set<int> respawning;
+};
+
+int main(int argc, char* argv[]) {
+    std::string server = "127.0.0.1:8080";
+    std::string match = "default";
+    int bot_count = 4;
+    double seconds = 20.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--server" && i + 1 < argc) {
+            server = argv[++i];
+        } else if (arg == "--match" && i + 1 < argc) {
+            match = argv[++i];
+        } else if (arg == "--bots" && i + 1 < argc) {
+            bot_count = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = std::max(1.0, std::stod(argv[++i]));
+        }
+    }
+    size_t colon = server.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Bad server " << server << ", expected host:port" << std::endl;
+        return 1;
+    }
+    tcp::endpoint endpoint(boost::asio::ip::make_address(server.substr(0, colon)),
+                           static_cast<unsigned short>(std::stoi(server.substr(colon + 1))));
+
+    boost::asio::io_context io_context;
+    std::vector<std::unique_ptr<Bot>> bots;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < bot_count; i++) bots.push_back(std::make_unique<Bot>(io_context, i));
+    for (auto& bot : bots) {
+        threads.emplace_back([&bot, &endpoint, &match, seconds] { bot->run(endpoint, match, seconds); });
+    }
+    std::cout << bot_count << " bots playing " << match << " on " << server << " for " << seconds << "s" << std::endl;
+    for (auto& thread : threads) thread.join();
+
+    std::cout << "Input to display latency of other bots' shots\n" << all_stats.report();
+    int shots = total_shots.load();
+    std::cout << "Hit registration: " << total_hits.load() << " of " << shots << " aimed shots hit ("
+              << (shots > 0 ? 100.0f * total_hits.load() / shots : 0.0f) << "%)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,266 @@
+// komi netem: a local TCP proxy that makes loopback look like a real network.
+//
+// sits between komi (or komi_bot) and a server and impairs both directions
+// of every connection: one-way delay, jitter, loss, a bandwidth cap and
+// reordering. komi only speaks TCP, so the impairments are what TCP turns
+// them into on a real link. bytes are never dropped or reordered, instead:
+//   - a lost segment is retransmitted, so its bytes and everything behind
+//     them stall for a retransmission timeout (--loss)
+//   - a reordered segment is held until the gap fills, a shorter stall (--reorder)
+//   - jitter can't let later bytes overtake earlier ones, so it queues them
+//   - past the bandwidth cap bytes queue up to --queue bytes, then the proxy
+//     stops reading and the sender's socket buffer fills like on a slow link
+// delays are one way, the round trip gets twice --delay.
+//
+//   ./komi_netem --listen 8090 --upstream 127.0.0.1:8080 --delay 40 --jitter 10 --loss 1 --rate 2000
+//   ./komi 127.0.0.1 8090
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+struct Impairment {
+    double delay_ms = 0.0;      // one way
+    double jitter_ms = 0.0;     // uniform +- around the delay
+    double loss_percent = 0.0;  // chance a read chunk needs a retransmission
+    double reorder_percent = 0.0;
+    double reorder_gap_ms = 10.0;
+    double rate_kbps = 0.0;     // 0 = unlimited
+    size_t queue_bytes = 64 * 1024;
+};
+
+// Linux never retransmits sooner than this, and a lost segment on a quiet
+// game stream rarely gets the three duplicate acks for a fast retransmit
+const double MIN_RTO_MS = 200.0;
+const size_t READ_CHUNK = 16 * 1024;
+
+Impairment impairment;
+
+struct Chunk {
+    Clock::time_point release; // when the far end may see these bytes
+    std::vector<char> data;
+};
+
+// one direction of a connection: a reader that stamps what arrives and a
+// writer that hands it on when its time comes
+struct Pipe {
+    const char* name;
+    tcp::socket& from;
+    tcp::socket& to;
+    std::mt19937 rng;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Chunk> queue;
+    size_t queued = 0;
+    bool reading_done = false;
+    bool failed = false;
+
+    Clock::time_point last_release{};
+    Clock::time_point link_free{}; // the bandwidth cap is busy until then
+
+    // reported when the connection closes
+    size_t bytes = 0;
+    size_t peak_queued = 0;
+    int loss_stalls = 0;
+    int reorder_stalls = 0;
+
+    Pipe(const char* name, tcp::socket& from, tcp::socket& to, unsigned seed)
+        : name(name), from(from), to(to), rng(seed) {}
+};
+
+struct Connection {
+    int id;
+    tcp::socket client;
+    tcp::socket server;
+    std::unique_ptr<Pipe> up;   // client -> server
+    std::unique_ptr<Pipe> down; // server -> client
+
+    Connection(boost::asio::io_context& io_context, int id) : id(id), client(io_context), server(io_context) {}
+};
+
+Clock::duration ms(double milliseconds) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+// when bytes read now may come out the other end. the caller holds pipe.mutex.
+Clock::time_point release_time(Pipe& pipe, size_t size, Clock::time_point now) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    // serialisation at the bottleneck, back to back while the link is busy
+    Clock::time_point sent = now;
+    if (impairment.rate_kbps > 0.0) {
+        sent = std::max(now, pipe.link_free) + ms(size * 8.0 / impairment.rate_kbps);
+        pipe.link_free = sent;
+    }
+
+    double delay = impairment.delay_ms + (unit(pipe.rng) * 2.0 - 1.0) * impairment.jitter_ms;
+    delay = std::max(0.0, delay);
+    if (unit(pipe.rng) * 100.0 < impairment.loss_percent) {
+        delay += std::max(MIN_RTO_MS, 4.0 * impairment.delay_ms);
+        pipe.loss_stalls++;
+    } else if (unit(pipe.rng) * 100.0 < impairment.reorder_percent) {
+        delay += impairment.reorder_gap_ms;
+        pipe.reorder_stalls++;
+    }
+
+    // TCP delivers in order, nothing overtakes what is already queued
+    Clock::time_point release = std::max(pipe.last_release, sent + ms(delay));
+    pipe.last_release = release;
+    return release;
+}
+
+void pipe_reader(Pipe& pipe) {
+    std::vector<char> buf(READ_CHUNK);
+    while (true) {
+        boost::system::error_code ec;
+        size_t n = pipe.from.read_some(boost::asio::buffer(buf), ec);
+        if (ec) break;
+
+        std::unique_lock<std::mutex> lock(pipe.mutex);
+        Chunk chunk{release_time(pipe, n, Clock::now()), std::vector<char>(buf.begin(), buf.begin() + n)};
+        pipe.queue.push_back(std::move(chunk));
+        pipe.queued += n;
+        pipe.bytes += n;
+        pipe.peak_queued = std::max(pipe.peak_queued, pipe.queued);
+        pipe.changed.notify_all();
+
+        // a full bottleneck queue pushes back on the sender
+        pipe.changed.wait(lock, [&] { return pipe.failed || pipe.queued < impairment.queue_bytes; });
+        if (pipe.failed) break;
+    }
+
+    std::lock_guard<std::mutex> lock(pipe.mutex);
+    pipe.reading_done = true;
+    pipe.changed.notify_all();
+}
+
+void pipe_writer(Pipe& pipe) {
+    while (true) {
+        Chunk chunk;
+        {
+            std::unique_lock<std::mutex> lock(pipe.mutex);
+            pipe.changed.wait(lock, [&] { return pipe.failed || pipe.reading_done || !pipe.queue.empty(); });
+            if (pipe.failed || pipe.queue.empty()) break; // the queue drains before a close goes through
+            Clock::time_point release = pipe.queue.front().release;
+            lock.unlock();
+            std::this_thread::sleep_until(release);
+            lock.lock();
+            chunk = std::move(pipe.queue.front());
+            pipe.queue.pop_front();
+            pipe.queued -= chunk.data.size();
+            pipe.changed.notify_all();
+        }
+
+        boost::system::error_code ec;
+        boost::asio::write(pipe.to, boost::asio::buffer(chunk.data), ec);
+        if (ec) {
+            std::lock_guard<std::mutex> lock(pipe.mutex);
+            pipe.failed = true;
+            pipe.changed.notify_all();
+            break;
+        }
+    }
+
+    // pass the close on, the reader of the other direction sees it and winds down too
+    boost::system::error_code ignored;
+    pipe.to.shutdown(tcp::socket::shutdown_send, ignored);
+    std::lock_guard<std::mutex> lock(pipe.mutex);
+    if (pipe.failed) pipe.from.shutdown(tcp::socket::shutdown_receive, ignored);
+}
+
+void run_connection(std::shared_ptr<Connection> connection, tcp::endpoint upstream) {
+    // a small receive buffer keeps the server's own send queue honest when we stop
+    // reading. it has to be set before connecting to shape the advertised window.
+    boost::system::error_code ec;
+    connection->server.open(tcp::v4(), ec);
+    if (!ec) connection->server.set_option(boost::asio::socket_base::receive_buffer_size(static_cast<int>(impairment.queue_bytes)), ec);
+    if (!ec) connection->server.connect(upstream, ec);
+    if (ec) {
+        std::cerr << "Connection " << connection->id << ": can't reach upstream: " << ec.message() << std::endl;
+        return;
+    }
+    connection->server.set_option(tcp::no_delay(true));
+
+    connection->up = std::make_unique<Pipe>("up", connection->client, connection->server, connection->id * 2);
+    connection->down = std::make_unique<Pipe>("down", connection->server, connection->client, connection->id * 2 + 1);
+
+    std::vector<std::thread> threads;
+    for (Pipe* pipe : {connection->up.get(), connection->down.get()}) {
+        threads.emplace_back(pipe_reader, std::ref(*pipe));
+        threads.emplace_back(pipe_writer, std::ref(*pipe));
+    }
+    for (auto& thread : threads) thread.join();
+
+    for (Pipe* pipe : {connection->up.get(), connection->down.get()}) {
+        std::cout << "Connection " << connection->id << " " << pipe->name << ": " << pipe->bytes << " bytes, peak queue "
+                  << pipe->peak_queued << " bytes, " << pipe->loss_stalls << " loss stalls, "
+                  << pipe->reorder_stalls << " reorder stalls" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned short port = 8090;
+    std::string upstream = "127.0.0.1:8080";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--listen" && i + 1 < argc) {
+            port = static_cast<unsigned short>(std::stoi(argv[++i]));
+        } else if (arg == "--upstream" && i + 1 < argc) {
+            upstream = argv[++i];
+        } else if (arg == "--delay" && i + 1 < argc) {
+            impairment.delay_ms = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--jitter" && i + 1 < argc) {
+            impairment.jitter_ms = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--loss" && i + 1 < argc) {
+            impairment.loss_percent = std::clamp(std::stod(argv[++i]), 0.0, 100.0);
+        } else if (arg == "--reorder" && i + 1 < argc) {
+            impairment.reorder_percent = std::clamp(std::stod(argv[++i]), 0.0, 100.0);
+        } else if (arg == "--reorder-gap" && i + 1 < argc) {
+            impairment.reorder_gap_ms = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            impairment.rate_kbps = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            impairment.queue_bytes = std::max(4096, std::stoi(argv[++i]));
+        }
+    }
+    size_t colon = upstream.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Bad upstream " << upstream << ", expected host:port" << std::endl;
+        return 1;
+    }
+
+    try {
+        tcp::endpoint upstream_endpoint(boost::asio::ip::make_address(upstream.substr(0, colon)),
+                                        static_cast<unsigned short>(std::stoi(upstream.substr(colon + 1))));
+        boost::asio::io_context io_context;
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), port));
+        std::cout << "Impairing port " << port << " -> " << upstream << ": delay " << impairment.delay_ms
+                  << "ms, jitter " << impairment.jitter_ms << "ms, loss " << impairment.loss_percent
+                  << "%, reorder " << impairment.reorder_percent << "%, rate "
+                  << (impairment.rate_kbps > 0 ? std::to_string(static_cast<int>(impairment.rate_kbps)) + " kbps" : "unlimited")
+                  << std::endl;
+
+        int next_id = 1;
+        while (true) {
+            auto connection = std::make_shared<Connection>(io_context, next_id++);
+            acceptor.accept(connection->client);
+            connection->client.set_option(tcp::no_delay(true));
+            std::thread(run_connection, connection, upstream_endpoint).detach();
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Proxy error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,389 @@
+// komi relay: fans one match out to many spectators.
+//
+// the relay connects to a game server (or the gateway) once as a spectator,
+// rebuilds the snapshot stream with its own decoder and acks it upstream like
+// any client. everything it receives is queued with its arrival time and
+// replayed to its own spectators after --delay seconds. each snapshot is
+// encoded once as a delta against the previous one it broadcast, and that one
+// buffer is shared by every spectator. new spectators, and ones that fell too
+// far behind, get a keyframe instead. the game server only ever sees one
+// connection, however many people are watching.
+//
+//   ./komi_relay --upstream 127.0.0.1:8080 --match final --port 8081 --delay 30
+//   ./komi 127.0.0.1 8081 final --spectate
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "snapshot.hpp"
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+using Message = std::shared_ptr<const std::string>;
+
+// messages a spectator may have queued before it counts as lagging, ~2s of snapshots
+const size_t SPECTATOR_QUEUE_LIMIT = 120;
+// how often spectators waiting for a keyframe are checked when nothing is broadcast
+const auto KEYFRAME_POLL = std::chrono::milliseconds(100);
+
+struct Spectator {
+    std::shared_ptr<tcp::socket> socket;
+    int id;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Message> queue;
+    bool needs_keyframe = true; // next snapshot must be a keyframe
+    bool welcomed = false;      // has been sent the Arena and Map lines, or has them queued
+    Message queued_welcome;     // the welcome while it's still in the queue
+    bool closed = false;
+};
+
+// something received from upstream, waiting out the broadcast delay
+struct Delayed {
+    Clock::time_point arrival;
+    bool is_snapshot;
+    WorldSnapshot snapshot;
+    std::string line; // event lines (Hit, Score, Player ...), newline included
+};
+
+std::vector<std::shared_ptr<Spectator>> spectators;
+std::mutex spectators_mutex;
+
+std::deque<Delayed> pending;
+std::mutex pending_mutex;
+std::condition_variable pending_ready;
+
+std::string world_info; // Arena and Map lines from upstream, replayed to each new spectator
+std::mutex world_info_mutex;
+
+tcp::socket* upstream_socket = nullptr;
+std::mutex upstream_send_mutex;
+
+std::vector<std::string> split_by_space(const std::string& input) {
+    std::istringstream iss(input);
+    std::string word;
+    std::vector<std::string> words;
+
+    while (iss >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+void send_upstream(const std::string& msg) {
+    std::lock_guard<std::mutex> lock(upstream_send_mutex);
+    boost::system::error_code ec;
+    boost::asio::write(*upstream_socket, boost::asio::buffer(msg), ec);
+}
+
+// queues a message for one spectator. a spectator that can't keep up has its
+// backlog dropped and catches up with a keyframe instead.
+void enqueue(Spectator& spectator, const Message& msg) {
+    std::lock_guard<std::mutex> lock(spectator.mutex);
+    if (spectator.closed) return;
+    if (spectator.queue.size() >= SPECTATOR_QUEUE_LIMIT) {
+        spectator.queue.clear();
+        spectator.needs_keyframe = true;
+        // a welcome dropped with the backlog goes out again with the keyframe
+        if (spectator.queued_welcome) {
+            spectator.welcomed = false;
+            spectator.queued_welcome.reset();
+        }
+        std::cout << "Spectator " << spectator.id << " fell behind, resyncing" << std::endl;
+        return;
+    }
+    spectator.queue.push_back(msg);
+    spectator.ready.notify_one();
+}
+
+void spectator_writer(std::shared_ptr<Spectator> spectator) {
+    while (true) {
+        Message msg;
+        {
+            std::unique_lock<std::mutex> lock(spectator->mutex);
+            spectator->ready.wait(lock, [&] { return spectator->closed || !spectator->queue.empty(); });
+            if (spectator->closed) return;
+            msg = std::move(spectator->queue.front());
+            spectator->queue.pop_front();
+            if (msg == spectator->queued_welcome) spectator->queued_welcome.reset();
+        }
+        boost::system::error_code ec;
+        boost::asio::write(*spectator->socket, boost::asio::buffer(*msg), ec);
+        if (ec) {
+            std::lock_guard<std::mutex> lock(spectator->mutex);
+            spectator->closed = true;
+            return;
+        }
+    }
+}
+
+// spectators only ever send Ack (ignored, the stream is shared) and Resync
+void spectator_reader(std::shared_ptr<Spectator> spectator) {
+    boost::asio::streambuf buf;
+    boost::system::error_code ec;
+    while (true) {
+        boost::asio::read_until(*spectator->socket, buf, "\n", ec);
+        if (ec) break;
+        std::istream is(&buf);
+        std::string line;
+        std::getline(is, line);
+        if (line.rfind("Resync", 0) == 0) {
+            std::lock_guard<std::mutex> lock(spectator->mutex);
+            spectator->needs_keyframe = true;
+        }
+    }
+
+    std::cout << "Spectator " << spectator->id << " left" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(spectator->mutex);
+        spectator->closed = true;
+        spectator->queue.clear();
+    }
+    spectator->ready.notify_one();
+    spectator->socket->shutdown(tcp::socket::shutdown_both, ec);
+}
+
+// live spectators, dropping the ones that have gone away
+std::vector<std::shared_ptr<Spectator>> live_spectators() {
+    std::lock_guard<std::mutex> lock(spectators_mutex);
+    spectators.erase(std::remove_if(spectators.begin(), spectators.end(),
+        [](const std::shared_ptr<Spectator>& s) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            return s->closed;
+        }), spectators.end());
+    return spectators;
+}
+
+// gives every spectator that needs one a keyframe of the last broadcast snapshot.
+// the keyframe is encoded at most once per call and shared.
+void send_keyframes(const std::vector<std::shared_ptr<Spectator>>& targets, const WorldSnapshot& last_sent) {
+    Message keyframe, welcome;
+    for (auto& spectator : targets) {
+        bool welcomed;
+        {
+            std::lock_guard<std::mutex> lock(spectator->mutex);
+            if (!spectator->needs_keyframe) continue;
+            welcomed = spectator->welcomed;
+            spectator->needs_keyframe = false;
+            spectator->welcomed = true;
+        }
+        if (!keyframe) {
+            std::string text;
+            encode_snapshot(nullptr, last_sent, text);
+            keyframe = std::make_shared<const std::string>(std::move(text));
+        }
+        if (!welcomed) {
+            if (!welcome) {
+                std::lock_guard<std::mutex> lock(world_info_mutex);
+                welcome = std::make_shared<const std::string>(world_info);
+            }
+            {
+                // marked before queueing, so an overflow inside enqueue undoes the welcome too
+                std::lock_guard<std::mutex> lock(spectator->mutex);
+                spectator->queued_welcome = welcome;
+            }
+            enqueue(*spectator, welcome);
+        }
+        enqueue(*spectator, keyframe);
+    }
+}
+
+// sends one delayed snapshot or event to every spectator
+void broadcast(const Delayed& item, WorldSnapshot& last_sent) {
+    std::vector<std::shared_ptr<Spectator>> targets = live_spectators();
+
+    if (!item.is_snapshot) {
+        Message line = std::make_shared<const std::string>(item.line);
+        for (auto& spectator : targets) enqueue(*spectator, line);
+        return;
+    }
+
+    // one delta for everyone in sync, encoded once
+    std::string delta_text;
+    bool changed = encode_snapshot(last_sent.tick != 0 ? &last_sent : nullptr, item.snapshot, delta_text);
+    if (changed) {
+        // an unchanged snapshot is never sent, so it must not become the next baseline
+        last_sent = item.snapshot;
+        Message delta = std::make_shared<const std::string>(std::move(delta_text));
+        for (auto& spectator : targets) {
+            {
+                std::lock_guard<std::mutex> lock(spectator->mutex);
+                if (spectator->needs_keyframe) continue;
+            }
+            enqueue(*spectator, delta);
+        }
+    }
+    send_keyframes(targets, last_sent);
+}
+
+void broadcaster(double delay_seconds) {
+    auto delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(delay_seconds));
+    WorldSnapshot last_sent;
+    while (true) {
+        Delayed item;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex);
+            // the queue is in arrival order, so only the front can be due. wake up
+            // now and then anyway, the server sends nothing while the world is still
+            // and new spectators shouldn't have to wait for something to move.
+            auto wake_at = Clock::now() + KEYFRAME_POLL;
+            if (!pending.empty()) wake_at = std::min(wake_at, pending.front().arrival + delay);
+            pending_ready.wait_until(lock, wake_at);
+            bool due = !pending.empty() && Clock::now() >= pending.front().arrival + delay;
+            if (due) {
+                item = std::move(pending.front());
+                pending.pop_front();
+            } else {
+                lock.unlock();
+                if (last_sent.tick != 0) send_keyframes(live_spectators(), last_sent);
+                continue;
+            }
+        }
+        broadcast(item, last_sent);
+    }
+}
+
+void push_pending(Delayed item) {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending.push_back(std::move(item));
+    }
+    pending_ready.notify_one();
+}
+
+void accept_spectators(unsigned short port) {
+    try {
+        boost::asio::io_context io_context;
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), port));
+        std::cout << "Relay listening for spectators on port " << port << "...\n";
+
+        int next_id = 1;
+        while (true) {
+            auto socket = std::make_shared<tcp::socket>(io_context);
+            acceptor.accept(*socket);
+            socket->set_option(tcp::no_delay(true));
+
+            auto spectator = std::make_shared<Spectator>();
+            spectator->socket = socket;
+            spectator->id = next_id++;
+            {
+                std::lock_guard<std::mutex> lock(spectators_mutex);
+                spectators.push_back(spectator);
+            }
+            std::cout << "Spectator " << spectator->id << " connected" << std::endl;
+            std::thread(spectator_writer, spectator).detach();
+            std::thread(spectator_reader, spectator).detach();
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Relay accept error: " << e.what() << std::endl;
+        std::exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string upstream = "127.0.0.1:8080";
+    std::string match = "default";
+    unsigned short port = 8081;
+    double delay_seconds = 0.0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--upstream" && i + 1 < argc) {
+            upstream = argv[++i];
+        } else if (arg == "--match" && i + 1 < argc) {
+            match = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<unsigned short>(std::stoi(argv[++i]));
+        } else if (arg == "--delay" && i + 1 < argc) {
+            delay_seconds = std::max(0.0, std::stod(argv[++i]));
+        }
+    }
+    size_t colon = upstream.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Bad upstream " << upstream << ", expected host:port" << std::endl;
+        return 1;
+    }
+
+    try {
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        socket.connect(tcp::endpoint(boost::asio::ip::make_address(upstream.substr(0, colon)),
+                                     static_cast<unsigned short>(std::stoi(upstream.substr(colon + 1)))));
+        socket.set_option(tcp::no_delay(true));
+        upstream_socket = &socket;
+        send_upstream("Spectate " + match + "\n");
+        std::cout << "Relaying match " << match << " from " << upstream
+                  << " with a " << delay_seconds << "s delay" << std::endl;
+
+        std::thread(broadcaster, delay_seconds).detach();
+        std::thread(accept_spectators, port).detach();
+
+        SnapshotHistory history;
+        SnapshotDecoder decoder;
+        uint32_t snap_tick = 0;
+        boost::asio::streambuf buf;
+        while (true) {
+            boost::asio::read_until(socket, buf, "\n");
+            std::istream is(&buf);
+            std::string line;
+            std::getline(is, line);
+            std::vector<std::string> tokens = split_by_space(line);
+            if (tokens.empty()) continue;
+            const std::string& type = tokens[0];
+
+            try {
+                if (type == "Snap" && tokens.size() >= 3) {
+                    uint32_t tick = static_cast<uint32_t>(std::stoul(tokens[1]));
+                    uint32_t base_tick = static_cast<uint32_t>(std::stoul(tokens[2]));
+                    snap_tick = tick;
+                    if (!decoder.begin(tick, base_tick, history)) send_upstream("Resync\n");
+                } else if (type == "B" && tokens.size() >= 9) {
+                    decoder.bullet_added({static_cast<uint32_t>(std::stoul(tokens[1])), std::stof(tokens[2]),
+                                          std::stof(tokens[3]), std::stof(tokens[4]), std::stof(tokens[5]),
+                                          std::stoi(tokens[6]), static_cast<uint32_t>(std::stoul(tokens[7])),
+                                          static_cast<uint32_t>(std::stoul(tokens[8]))});
+                } else if (type == "b" && tokens.size() >= 4) {
+                    decoder.bullet_moved(static_cast<uint32_t>(std::stoul(tokens[1])),
+                                         std::stof(tokens[2]), std::stof(tokens[3]));
+                } else if (type == "-B" && tokens.size() >= 2) {
+                    decoder.bullet_removed(static_cast<uint32_t>(std::stoul(tokens[1])));
+                } else if (type == "P" && tokens.size() >= 4) {
+                    // stamped so our own encoder knows the player changed since its baseline
+                    decoder.player_updated({std::stoi(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3]), snap_tick});
+                } else if (type == "-P" && tokens.size() >= 2) {
+                    decoder.player_removed(std::stoi(tokens[1]));
+                } else if (type == "SnapEnd") {
+                    const WorldSnapshot* snap = decoder.end();
+                    if (!snap) continue;
+                    history.push(*snap);
+                    send_upstream("Ack " + std::to_string(snap->tick) + "\n");
+                    push_pending({Clock::now(), true, *snap, {}});
+                } else if (type == "Arena" || type == "Map") {
+                    std::lock_guard<std::mutex> lock(world_info_mutex);
+                    world_info += line + "\n";
+                } else if (type == "Ping" && tokens.size() >= 3) {
+                    // our own link to the server, not something to replay
+                    send_upstream("Pong " + tokens[1] + " " + tokens[2] + " 0\n");
+                } else if (type == "NoMatch") {
+                    std::cerr << "Match " << match << " is not running" << std::endl;
+                    return 1;
+                } else {
+                    // game events (Hit, Score, Win, Player ...) replay in order with the snapshots
+                    push_pending({Clock::now(), false, {}, line + "\n"});
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error parsing upstream message: " << e.what() << std::endl;
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Upstream closed: " << e.what() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+#pragma once
+// input-to-display latency of shots, shared by komi and komi_bot.
+//
+// the shooter stamps a shot when its input was sampled and when Fire was
+// sent. the server adds when it received the shot, when the bullet first went
+// into a snapshot and when that snapshot was encoded for each client, and
+// sends all of it in a Lat line ahead of the snapshot. the viewing client
+// adds when the snapshot arrived and when the bullet was first drawn. all
+// stamps are microseconds on the server clock. clients convert their own
+// clock using the Ping stamps, see ClockOffset.
+//
+// measuring is opt-in: a client sends Measure after joining and only then
+// stamps its shots. the server sends a Lat line only to clients that sent
+// Measure, and only for shots whose first bullet is in their view.
+//
+//   Lat <first_bullet_id> <pellets> <owner> <input> <client_send> <server_recv> <server_sim> <server_send>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LatencyStamps {
+    uint64_t input = 0;        // shooter sampled the key
+    uint64_t client_send = 0;  // shooter wrote Fire
+    uint64_t server_recv = 0;  // server read Fire
+    uint64_t server_sim = 0;   // bullet first went into a snapshot
+    uint64_t server_send = 0;  // that snapshot was encoded for this client
+    uint64_t client_recv = 0;  // this client applied the snapshot
+    uint64_t draw = 0;         // this client first drew the bullet
+};
+
+// maps local steady-clock microseconds onto the server clock. every Ping says
+// what the server clock read when it was sent and the last round trip; the
+// sample with the smallest round trip gives the tightest estimate.
+class ClockOffset {
+public:
+    void on_ping(uint64_t server_us, uint64_t rtt_us, uint64_t local_us) {
+        if (rtt_us == 0) return; // no round trip measured yet
+        if (samples > 0 && rtt_us > best_rtt) {
+            // let the best sample age out slowly so clock drift is followed
+            best_rtt += best_rtt / 16 + 1;
+            return;
+        }
+        best_rtt = rtt_us;
+        offset = static_cast<int64_t>(local_us) - static_cast<int64_t>(server_us + rtt_us / 2);
+        samples++;
+    }
+
+    bool ready() const { return samples > 0; }
+    uint64_t to_server(uint64_t local_us) const { return static_cast<uint64_t>(static_cast<int64_t>(local_us) - offset); }
+
+private:
+    int64_t offset = 0;
+    uint64_t best_rtt = 0;
+    int samples = 0;
+};
+
+// percentiles of each leg of the chain over the samples seen so far
+class LatencyStats {
+public:
+    // keeps at most max_samples, allocated up front so add() never allocates
+    void reserve(size_t max_samples) {
+        capacity = max_samples;
+        for (auto& leg : legs) leg.reserve(max_samples);
+    }
+
+    void add(const LatencyStamps& s) {
+        if (legs[0].size() >= capacity) return;
+        push(0, s.client_send, s.input);       // client queue
+        push(1, s.server_recv, s.client_send); // uplink
+        push(2, s.server_sim, s.server_recv);  // tick wait
+        push(3, s.server_send, s.server_sim);  // broadcast
+        push(4, s.client_recv, s.server_send); // downlink
+        push(5, s.draw, s.client_recv);        // render
+        push(6, s.draw, s.input);              // input to display
+    }
+
+    size_t count() const { return legs[0].size(); }
+
+    void merge(const LatencyStats& other) {
+        for (int leg = 0; leg < LEGS; leg++) {
+            legs[leg].insert(legs[leg].end(), other.legs[leg].begin(), other.legs[leg].end());
+        }
+    }
+
+    // one line per leg: "<leg> p50 p95 p99" in milliseconds
+    std::string report() const {
+        static const char* names[LEGS] = {"client queue", "uplink", "tick wait", "broadcast",
+                                          "downlink", "render", "total"};
+        std::string out;
+        char line[128];
+        snprintf(line, sizeof(line), "%zu shots          p50      p95      p99 (ms)\n", count());
+        out += line;
+        for (int leg = 0; leg < LEGS; leg++) {
+            std::vector<float> sorted = legs[leg];
+            std::sort(sorted.begin(), sorted.end());
+            snprintf(line, sizeof(line), "  %-13s %7.2f  %7.2f  %7.2f\n", names[leg],
+                     percentile(sorted, 0.50f), percentile(sorted, 0.95f), percentile(sorted, 0.99f));
+            out += line;
+        }
+        return out;
+    }
+
+private:
+    static constexpr int LEGS = 7;
+    size_t capacity = 100000;
+
+    // clock estimates can put a leg a little below zero, clamp instead of wrapping
+    void push(int leg, uint64_t later, uint64_t earlier) {
+        legs[leg].push_back(later > earlier ? (later - earlier) / 1000.0f : 0.0f);
+    }
+
+    static float percentile(const std::vector<float>& sorted, float p) {
+        if (sorted.empty()) return 0.0f;
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+        return sorted[index];
+    }
+
+    std::vector<float> legs[LEGS];
+};
+
+// stamps of shots announced by Lat lines, waiting for their bullets to show up
+class LatencyTracker {
+public:
+    // a Lat line, tokens as split on spaces. shots by `self` are skipped,
+    // those are drawn by prediction and say nothing about the round trip.
+    void on_lat(const std::vector<std::string>& tokens, int self, uint64_t now_server_us) {
+        if (tokens.size() < 9) return;
+        try {
+            uint32_t first_id = static_cast<uint32_t>(std::stoul(tokens[1]));
+            uint32_t pellets = static_cast<uint32_t>(std::stoul(tokens[2]));
+            if (std::stoi(tokens[3]) == self) return;
+            LatencyStamps stamps;
+            stamps.input = std::stoull(tokens[4]);
+            stamps.client_send = std::stoull(tokens[5]);
+            stamps.server_recv = std::stoull(tokens[6]);
+            stamps.server_sim = std::stoull(tokens[7]);
+            stamps.server_send = std::stoull(tokens[8]);
+            // only the first pellet of a shot is measured
+            if (pellets > 0) pending[first_id] = {stamps, now_server_us};
+        } catch (const std::exception&) {
+            // malformed stamps are just not measured
+        }
+        expire(now_server_us);
+    }
+
+    // the snapshot carrying bullet_id was applied. returns true if it's being measured.
+    bool on_received(uint32_t bullet_id, uint64_t now_server_us) {
+        auto it = pending.find(bullet_id);
+        if (it == pending.end()) return false;
+        it->second.stamps.client_recv = now_server_us;
+        return true;
+    }
+
+    // bullet_id was drawn for the first time. records the sample into stats.
+    void on_drawn(uint32_t bullet_id, uint64_t now_server_us, LatencyStats& stats) {
+        auto it = pending.find(bullet_id);
+        if (it == pending.end() || it->second.stamps.client_recv == 0) return;
+        it->second.stamps.draw = now_server_us;
+        stats.add(it->second.stamps);
+        pending.erase(it);
+    }
+
+private:
+    struct Pending {
+        LatencyStamps stamps;
+        uint64_t announced;
+    };
+
+    // shots whose bullets never came into view
+    void expire(uint64_t now_server_us) {
+        const uint64_t max_age_us = 5000000;
+        for (auto it = pending.begin(); it != pending.end(); ) {
+            if (now_server_us - it->second.announced > max_age_us) it = pending.erase(it);
+            else ++it;
+        }
+    }
+
+    std::unordered_map<uint32_t, Pending> pending;
+};
@@ -0,0 +1,143 @@
+#pragma once
+// static map geometry shared by server and client.
+//
+// a .kmap file is a small header followed by one byte per tile (1 = wall).
+// the tile bytes are the collision grid, so nothing is built at load time.
+// the file is mmap'd read-only and pages are faulted in on first touch.
+// every process that opens the same map shares the same physical pages.
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char MAP_MAGIC[4] = {'K', 'M', 'A', 'P'};
+const uint32_t MAP_VERSION = 1;
+
+struct MapHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t width, height; // arena size in pixels
+    uint32_t tile_size;     // pixels per tile
+    uint32_t cols, rows;    // tile grid, cols * rows bytes follow the header
+};
+
+class MapView {
+public:
+    MapView() = default;
+    ~MapView() { close(); }
+    MapView(const MapView&) = delete;
+    MapView& operator=(const MapView&) = delete;
+
+    // maps the file read-only. returns false (and stays empty) if it's missing or malformed.
+    bool open(const std::string& path, std::string& error) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "can't open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MapHeader)) {
+            ::close(fd);
+            error = path + " is too small to be a map";
+            return false;
+        }
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            error = "can't map " + path + ": " + std::strerror(errno);
+            return false;
+        }
+
+        const MapHeader* h = static_cast<const MapHeader*>(data);
+        bool valid = std::memcmp(h->magic, MAP_MAGIC, 4) == 0 && h->version == MAP_VERSION &&
+                     h->tile_size > 0 && h->cols > 0 && h->rows > 0 &&
+                     static_cast<uint64_t>(h->cols) * h->tile_size >= h->width &&
+                     static_cast<uint64_t>(h->rows) * h->tile_size >= h->height &&
+                     sizeof(MapHeader) + static_cast<uint64_t>(h->cols) * h->rows <= static_cast<uint64_t>(st.st_size);
+        if (!valid) {
+            munmap(data, st.st_size);
+            error = path + " is not a valid version " + std::to_string(MAP_VERSION) + " map";
+            return false;
+        }
+
+        mapping = data;
+        mapping_size = st.st_size;
+        header = h;
+        tiles = static_cast<const uint8_t*>(data) + sizeof(MapHeader);
+        inv_tile = 1.0f / h->tile_size;
+        return true;
+    }
+
+    void close() {
+        if (mapping) munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+        header = nullptr;
+        tiles = nullptr;
+    }
+
+    bool loaded() const { return header != nullptr; }
+    float width() const { return header ? static_cast<float>(header->width) : 0.0f; }
+    float height() const { return header ? static_cast<float>(header->height) : 0.0f; }
+    int tile_size() const { return header ? static_cast<int>(header->tile_size) : 0; }
+    int cols() const { return header ? static_cast<int>(header->cols) : 0; }
+    int rows() const { return header ? static_cast<int>(header->rows) : 0; }
+    size_t file_size() const { return mapping_size; }
+
+    // FNV-1a over the whole file, so server and client can tell they have the same map.
+    // reads every page, call it once after open().
+    uint32_t checksum() const {
+        const uint8_t* bytes = static_cast<const uint8_t*>(mapping);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < mapping_size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    bool solid_tile(int col, int row) const {
+        if (!header) return false;
+        if (col < 0 || row < 0 || col >= static_cast<int>(header->cols) || row >= static_cast<int>(header->rows)) {
+            return true; // outside the grid counts as wall
+        }
+        return tiles[static_cast<size_t>(row) * header->cols + col] != 0;
+    }
+
+    // one lookup per call, used for bullets every step
+    bool solid_at(float x, float y) const {
+        if (!header) return false;
+        return solid_tile(static_cast<int>(std::floor(x * inv_tile)), static_cast<int>(std::floor(y * inv_tile)));
+    }
+
+    // true if a circle overlaps any wall tile, used for player movement
+    bool circle_hits_wall(float x, float y, float radius) const {
+        if (!header) return false;
+        int c0 = static_cast<int>(std::floor((x - radius) * inv_tile));
+        int c1 = static_cast<int>(std::floor((x + radius) * inv_tile));
+        int r0 = static_cast<int>(std::floor((y - radius) * inv_tile));
+        int r1 = static_cast<int>(std::floor((y + radius) * inv_tile));
+        float ts = static_cast<float>(header->tile_size);
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++) {
+                if (!solid_tile(c, r)) continue;
+                // closest point of the tile to the circle centre
+                float cx = std::fmax(c * ts, std::fmin(x, (c + 1) * ts));
+                float cy = std::fmax(r * ts, std::fmin(y, (r + 1) * ts));
+                float dx = x - cx, dy = y - cy;
+                if (dx * dx + dy * dy < radius * radius) return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    const MapHeader* header = nullptr;
+    const uint8_t* tiles = nullptr;
+    float inv_tile = 0.0f;
+};
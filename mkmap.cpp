@@ -0,0 +1,64 @@
+// writes the default komi arena as a .kmap file (see map.hpp)
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include "map.hpp"
+
+const int TILE_SIZE = 40;
+const int COLS = 96;  // 3840 px
+const int ROWS = 54;  // 2160 px
+
+int main(int argc, char* argv[]) {
+    std::string path = argc > 1 ? argv[1] : "maps/arena.kmap";
+    std::vector<uint8_t> tiles(COLS * ROWS, 0);
+    auto wall = [&](int col, int row, int w, int h) {
+        for (int r = row; r < row + h; r++) {
+            for (int c = col; c < col + w; c++) {
+                if (c >= 0 && r >= 0 && c < COLS && r < ROWS) tiles[r * COLS + c] = 1;
+            }
+        }
+    };
+
+    // outer border
+    wall(0, 0, COLS, 1);
+    wall(0, ROWS - 1, COLS, 1);
+    wall(0, 0, 1, ROWS);
+    wall(COLS - 1, 0, 1, ROWS);
+
+    // 2x2 pillars on a regular grid, leaving the spawn area in the middle open
+    for (int row = 8; row < ROWS - 4; row += 12) {
+        for (int col = 8; col < COLS - 4; col += 12) {
+            bool near_spawn = std::abs(col - COLS / 2) < 10 && std::abs(row - ROWS / 2) < 8;
+            if (!near_spawn) wall(col, row, 2, 2);
+        }
+    }
+
+    // long cover walls in each quadrant
+    wall(20, 14, 14, 1);
+    wall(COLS - 34, 14, 14, 1);
+    wall(20, ROWS - 15, 14, 1);
+    wall(COLS - 34, ROWS - 15, 14, 1);
+    wall(COLS / 2, 4, 1, 10);
+    wall(COLS / 2, ROWS - 14, 1, 10);
+
+    MapHeader header;
+    std::memcpy(header.magic, MAP_MAGIC, 4);
+    header.version = MAP_VERSION;
+    header.width = COLS * TILE_SIZE;
+    header.height = ROWS * TILE_SIZE;
+    header.tile_size = TILE_SIZE;
+    header.cols = COLS;
+    header.rows = ROWS;
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Can't write " << path << std::endl;
+        return 1;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(tiles.data()), tiles.size());
+    std::cout << "Wrote " << path << " (" << COLS << "x" << ROWS << " tiles)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,81 @@
+#!/bin/bash
+# plays komi_bot against a local server through komi_netem under a few
+# network conditions and prints one line per scenario: worst tick lateness
+# and unsent snapshot backlog seen on the admin port, the bots' input to
+# display latency and how many of their aimed shots hit.
+#
+#   ./build.sh first, then ./netem_scenarios.sh [seconds] [bots]
+# logs of every run end up in netem_results/<scenario>/.
+
+SECONDS_PER_RUN=${1:-20}
+BOTS=${2:-6}
+SERVER_PORT=9101
+ADMIN_PORT=10101
+PROXY_PORT=9100
+
+# name and komi_netem options, delays are one way
+SCENARIOS=(
+    "lan|"
+    "broadband|--delay 15 --jitter 3"
+    "wifi|--delay 25 --jitter 15 --loss 0.5 --reorder 2"
+    "mobile|--delay 60 --jitter 30 --loss 2 --rate 1500"
+    "congested|--delay 40 --jitter 10 --rate 200 --queue 32768"
+    "lossy|--delay 30 --loss 5"
+)
+
+for binary in server komi_netem komi_bot; do
+    if [ ! -x "./$binary" ]; then
+        echo "./$binary not found, run ./build.sh first"
+        exit 1
+    fi
+done
+
+# one admin command, prints the reply lines (up to LinksEnd for Links)
+admin() {
+    exec 3<>/dev/tcp/127.0.0.1/$ADMIN_PORT || return
+    printf '%s\n' "$1" >&3
+    while read -r -t 2 line <&3; do
+        echo "$line"
+        [ "$1" != "Links" ] || [ "$line" = "LinksEnd" ] && break
+    done
+    exec 3>&-
+}
+
+printf "%-10s %12s %14s %10s %10s %8s\n" scenario lateness_ms backlog_bytes p50_ms p95_ms hits
+for scenario in "${SCENARIOS[@]}"; do
+    name=${scenario%%|*}
+    options=${scenario#*|}
+    out=netem_results/$name
+    mkdir -p "$out"
+
+    ./server --port $SERVER_PORT --admin-port $ADMIN_PORT > "$out/server.log" 2>&1 &
+    server_pid=$!
+    sleep 0.5
+    ./komi_netem --listen $PROXY_PORT --upstream 127.0.0.1:$SERVER_PORT $options > "$out/netem.log" 2>&1 &
+    netem_pid=$!
+    sleep 0.5
+    ./komi_bot --server 127.0.0.1:$PROXY_PORT --bots "$BOTS" --seconds "$SECONDS_PER_RUN" > "$out/bots.log" 2>&1 &
+    bots_pid=$!
+
+    # sample the server while the bots play
+    worst_lateness=0
+    worst_backlog=0
+    while kill -0 $bots_pid 2> /dev/null; do
+        lateness=$(admin Status | sed -n 's/.*lateness_ms=\([0-9.]*\).*/\1/p')
+        backlog=$(admin Links | sed -n 's/.*queued=\([0-9]*\).*/\1/p' | sort -n | tail -1)
+        worst_lateness=$(awk -v a="${lateness:-0}" -v b="$worst_lateness" 'BEGIN { print (a > b) ? a : b }')
+        [ "${backlog:-0}" -gt "$worst_backlog" ] && worst_backlog=$backlog
+        echo "lateness_ms=${lateness:-?} backlog=${backlog:-?}" >> "$out/samples.log"
+        sleep 1
+    done
+    wait $bots_pid
+
+    kill $netem_pid $server_pid 2> /dev/null
+    wait $netem_pid $server_pid 2> /dev/null
+
+    total=$(grep '^  total' "$out/bots.log")
+    p50=$(echo "$total" | awk '{ print $2 }')
+    p95=$(echo "$total" | awk '{ print $3 }')
+    hits=$(sed -n 's/.*(\(.*\)%).*/\1/p' "$out/bots.log" | awk '{ printf "%.1f%%", $1 }')
+    printf "%-10s %12s %14s %10s %10s %8s\n" "$name" "$worst_lateness" "$worst_backlog" "${p50:--}" "${p95:--}" "${hits:--}"
+done
@@ -0,0 +1,99 @@
+#pragma once
+// per-connection link estimates and the snapshot rate they allow.
+//
+// the server feeds in round trip samples (Ping/Pong) and, every window, how
+// many bytes it wrote and how many are still sitting in the kernel's send
+// queue. what drained from the queue over the window is the throughput the
+// link actually delivered. a queue that keeps growing, or that would take too
+// long to drain, means we send faster than the link can carry, so the client
+// steps down a level: far bullets go first, then the rate drops 60 -> 30 -> 20 Hz.
+// it steps back up one level at a time after the link has looked healthy for a while.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+struct SendLevel {
+    uint32_t interval_ticks; // send a snapshot every this many ticks
+    float bullet_range;      // fraction of the area of interest bullets are sent from
+};
+
+const SendLevel SEND_LEVELS[] = {
+    {1, 1.0f}, // 60 Hz, everything in the area of interest
+    {1, 0.5f}, // 60 Hz, bullets only near the player
+    {2, 0.5f}, // 30 Hz
+    {3, 0.5f}, // 20 Hz
+};
+const int SEND_LEVEL_COUNT = sizeof(SEND_LEVELS) / sizeof(SEND_LEVELS[0]);
+
+class SendRateController {
+public:
+    // round trip of one Ping/Pong, smoothed like TCP's srtt
+    void on_rtt_sample(float rtt_ms) {
+        if (rtt_samples == 0) srtt = rtt_ms;
+        else srtt += (rtt_ms - srtt) * 0.125f;
+        rtt_samples++;
+    }
+
+    // called once per window with the bytes written during it and the bytes
+    // still unsent in the kernel at its end
+    void on_window(float seconds, size_t bytes_written, size_t queued_bytes) {
+        long drained = static_cast<long>(bytes_written) + static_cast<long>(last_queued) - static_cast<long>(queued_bytes);
+        float rate = std::max(0L, drained) / seconds;
+        // only windows with something to send say anything about capacity
+        if (bytes_written > 0 || last_queued > 0) {
+            throughput = throughput_samples == 0 ? rate : throughput * 0.7f + rate * 0.3f;
+            throughput_samples++;
+        }
+        growing_windows = queued_bytes > last_queued ? growing_windows + 1 : 0;
+        queued = queued_bytes;
+        last_queued = queued_bytes;
+
+        bool congested = queue_delay_ms() > CONGESTED_QUEUE_MS ||
+                         (growing_windows >= 2 && queued_bytes > GROWING_QUEUE_BYTES) ||
+                         (rtt_samples > 0 && srtt > CONGESTED_RTT_MS);
+        bool healthy = queue_delay_ms() < HEALTHY_QUEUE_MS && (rtt_samples == 0 || srtt < HEALTHY_RTT_MS);
+
+        if (congested) {
+            current = std::min(current + 1, SEND_LEVEL_COUNT - 1);
+            healthy_windows = 0;
+        } else if (healthy) {
+            if (++healthy_windows >= RECOVER_WINDOWS && current > 0) {
+                current--;
+                healthy_windows = 0;
+            }
+        } else {
+            healthy_windows = 0;
+        }
+    }
+
+    int level() const { return current; }
+    const SendLevel& send_level() const { return SEND_LEVELS[current]; }
+    float srtt_ms() const { return srtt; }
+    float throughput_bytes() const { return throughput; }
+    size_t queued_bytes() const { return queued; }
+
+    // how long the current backlog takes to drain at the measured rate
+    float queue_delay_ms() const {
+        if (queued == 0) return 0.0f;
+        if (throughput <= 0.0f) return 1e6f;
+        return queued / throughput * 1000.0f;
+    }
+
+private:
+    static constexpr float CONGESTED_QUEUE_MS = 100.0f;
+    static constexpr float HEALTHY_QUEUE_MS = 20.0f;
+    static constexpr float CONGESTED_RTT_MS = 250.0f;
+    static constexpr float HEALTHY_RTT_MS = 150.0f;
+    static constexpr size_t GROWING_QUEUE_BYTES = 4096;
+    static constexpr int RECOVER_WINDOWS = 4;
+
+    int current = 0;
+    float srtt = 0.0f;
+    int rtt_samples = 0;
+    float throughput = 0.0f;
+    int throughput_samples = 0;
+    size_t queued = 0;
+    size_t last_queued = 0;
+    int growing_windows = 0;
+    int healthy_windows = 0;
+};
@@ -9,6 +9,22 @@
 #include <sstream>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include "interest_grid.hpp"
+#include "job_system.hpp"
+#include "map.hpp"
+#include "send_rate.hpp"
+#include "slot_map.hpp"
+#include "snapshot.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+#include "weapons.hpp"
 
 using boost::asio::ip::tcp;
 
@@ -26,34 +42,81 @@ struct Player {
     Vector2 position;
     float radius = 15.0f;
     int score = 0;
+    bool dirty = true;          // position changed since the last tick
+    uint32_t changed_tick = 0;  // last tick the position was published as changed
+    uint32_t next_fire_tick = 0; // weapon cooldown
+    bool alive = true;           // false while waiting to respawn after a hit
+    uint32_t last_activity_tick = 0;
     
     Player() : client_id(0), position(0, 0) {}
     Player(int id, Vector2 pos) : client_id(id), position(pos) {}
 };
 
 struct Bullet {
+    uint32_t id = 0;
     int owner_id;
+    uint32_t shot_seq = 0; // the owner's tag for the shot, echoed so it can reconcile its prediction
+    uint32_t pellet = 0;
     Vector2 position;
-    float speed = 600.0f;
-    std::string direction;
+    Vector2 velocity;      // pixels per second
+    TimerHandle expiry;    // lifetime timer, cancelled if the bullet is removed early
     static constexpr float RADIUS = 5.0f;
     
-    Bullet(int owner, Vector2 pos, float spd, std::string dir) 
-        : owner_id(owner), position(pos), speed(spd), direction(dir) {}
+    Bullet(int owner, Vector2 pos, Vector2 vel) 
+        : owner_id(owner), position(pos), velocity(vel) {}
+};
+
+// bytes waiting for one client's writer thread. the game only appends under the
+// queue's own mutex, so a client that stops reading stalls its writer and
+// nothing else, and no socket write ever happens under a game lock.
+struct SendQueue {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> messages;
+    std::vector<std::string> spare; // written messages, reused for their capacity
+    size_t bytes = 0;               // queued, not yet handed to the kernel
+    uint64_t write_started_us = 0;  // the write in progress began then, 0 = not writing
+    bool closed = false;            // the session is gone, the writer stops
+    bool failed = false;            // a write failed or the client was dropped
 };
 
 struct ClientSession {
     std::shared_ptr<tcp::socket> socket;
-    int client_id;
+    std::shared_ptr<SendQueue> send_queue = std::make_shared<SendQueue>();
+    size_t send_limit = 0;    // unsent bytes past which snapshots are held back
+    int client_id = 0;        // this session's key in clients, players mirror it
+    uint32_t acked_tick = 0;  // newest snapshot the client confirmed, 0 = none
+    SnapshotHistory history;  // snapshots sent to this client, for delta baselines
+    std::string outbox;       // encoded snapshot, reused every tick
+    bool send_failed = false;      // dropped, nothing more is sent until the session removes it
+    bool spectator = false;        // read-only, sees the whole world and has no player
+    float view_width = 1280.0f;    // client viewport, sets its area of interest
+    float view_height = 720.0f;
+    WorldSnapshot view;            // what this client can see this tick
+    std::vector<uint32_t> visible; // scratch for interest queries
     
-    ClientSession(std::shared_ptr<tcp::socket> sock, int id) 
-        : socket(sock), client_id(id) {}
+    // link measurement, touched only by the game loop and Pong handling
+    SendRateController rate;
+    uint32_t next_send_tick = 0;   // snapshots are skipped until then on slow links
+    uint32_t next_ping_tick = 0;
+    uint32_t ping_seq = 0;
+    float last_rtt_ms = 0.0f;
+    size_t window_bytes = 0;       // written since the window started
+    size_t queued_bytes = 0;       // unsent in the kernel and our queue, refreshed every tick
+    bool measure_latency = false;  // asked for Lat lines with Measure
+    uint64_t next_shot_stamp = 0;  // first entry of shot_stamps not yet considered for a Lat line
+    
+    ClientSession(std::shared_ptr<tcp::socket> sock, bool is_spectator = false) 
+        : socket(sock), spectator(is_spectator) {}
 };
 
-// global game state
-std::vector<ClientSession> clients;
-std::unordered_map<int, Player> players;
+// global game state. a client id is its session's key in clients, and its
+// player (if any) is stored under the same key in players.
+SlotMap<ClientSession> clients;
+SlotMap<Player> players;
 std::vector<Bullet> bullets;
+uint32_t next_bullet_id = 1;
+uint32_t server_tick = 0;
 std::mutex clients_mutex;
 std::mutex game_state_mutex;
 
@@ -61,12 +124,97 @@ GameState current_game_state = GameState::Playing;
 std::unordered_set<int> players_ready_to_restart;
 std::mutex game_state_mutex_extra;
 
+// scheduled game events, all driven by server_tick
+enum class TimerKind : uint8_t {
+    BulletExpire,     // id = bullet id
+    Respawn,          // id = client id
+    RestartCountdown, // id unused
+    IdleCheck         // id = client id
+};
+struct TimerEvent {
+    TimerKind kind = TimerKind::BulletExpire;
+    uint32_t id = 0;
+};
+TimerWheel<TimerEvent> timers; // guarded by game_state_mutex
+TimerHandle restart_timer;
+std::vector<uint32_t> expired_bullets; // reused every tick
+
+// latency stamps of shots that carried them (see latency.hpp), sent in a Lat
+// line ahead of the next snapshot to clients that sent Measure and can see the
+// bullet. guarded by game_state_mutex.
+struct ShotStamp {
+    uint32_t first_bullet_id;
+    uint32_t pellets;
+    int owner_id;
+    uint64_t input;       // the shooter's stamps, already on our clock
+    uint64_t client_send;
+    uint64_t server_recv;
+    uint64_t server_sim = 0; // set by the first snapshot that has the bullets
+};
+std::deque<ShotStamp> shot_stamps;
+uint64_t first_shot_stamp = 0; // running number of shot_stamps.front()
+const float SHOT_STAMP_LIFETIME = 2.0f; // seconds a stamp waits for clients that skip snapshots
+
+// a bullet that hit a player (target_id) or a wall / left the arena (-1)
+struct BulletHit {
+    size_t bullet_index;
+    int target_id;
+};
+
+// per-tick work is split across these threads
+JobSystem* jobs = nullptr;
+std::vector<std::vector<BulletHit>> hit_buffers; // one per job thread
+
+// collision scratch, reused every tick so the tick doesn't allocate once warmed up
+std::vector<const Player*> collision_targets;
+std::vector<BulletHit> collision_hits;
+const size_t BULLET_CHUNK = 256;
+const size_t CLIENT_CHUNK = 4;
+
 // game constants
-const int SCREEN_WIDTH = 1280;
-const int SCREEN_HEIGHT = 720;
+const char* DEFAULT_MAP = "maps/arena.kmap";
+const float INTEREST_CELL = 256.0f;
+const float INTEREST_MARGIN = 128.0f; // entities this far outside the viewport are still sent
 const float TICK_RATE = 60.0f; // server tick rate
-const float BULLET_LIFETIME = 5.0f; // seconds
 const int MAX_SCORE = 10;
+const float RESPAWN_DELAY = 1.0f;      // seconds a hit player can't be hit or shoot
+const float RESTART_COUNTDOWN = 10.0f; // seconds from game over to a new game
+const float IDLE_TIMEOUT = 30.0f;      // seconds without input before a kick, Pong and Ack don't count
+const uint32_t FIRE_SLACK_TICKS = 1;   // how early a shot may arrive before its cooldown is over
+const float PING_INTERVAL = 0.5f;      // seconds between RTT probes per client
+const uint32_t RATE_WINDOW = 30;       // ticks per link measurement window
+const size_t SEND_QUEUE_LIMIT = 64 * 1024; // unsent bytes past which snapshots are held back, at most the socket's buffer
+const size_t SEND_BACKLOG_LIMIT = 256 * 1024; // queued bytes past which a client that isn't reading is dropped
+const float SEND_STALL_TIMEOUT = 5.0f;     // seconds a single write may block before the client is dropped
+const size_t SPARE_MESSAGES = 4;           // written buffers a send queue keeps for reuse
+
+// load reporting for the gateway, read from the admin port
+std::atomic<float> tick_lateness_ms{0.0f}; // smoothed overrun of the tick deadline
+std::atomic<bool> draining{false};         // gateway should stop placing new matches here
+
+// tick traces, dumped on SIGUSR2 or the admin Trace command
+const double TRACE_DUMP_SECONDS = 5.0;
+std::atomic<bool> trace_dump_requested{false};
+
+// microseconds on the server clock, the time base of Ping/Pong
+const auto server_start = std::chrono::steady_clock::now();
+uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - server_start).count();
+}
+
+// static geometry, mapped read-only before the game thread starts and shared by every reader
+MapView game_map;
+std::string map_name;
+uint32_t map_checksum = 0; // sent with the name so clients can tell their copy differs
+
+// arena size comes from the map, maps can be larger than a client's screen
+float arena_width = 3840.0f;
+float arena_height = 2160.0f;
+
+// area-of-interest grids, rebuilt from the snapshot every tick
+InterestGrid bullet_grid(arena_width, arena_height, INTEREST_CELL);
+InterestGrid player_grid(arena_width, arena_height, INTEREST_CELL);
 
 bool check_collision_circles(Vector2 pos1, float radius1, Vector2 pos2, float radius2) {
     float dx = pos1.x - pos2.x;
@@ -75,36 +223,128 @@ bool check_collision_circles(Vector2 pos1, float radius1, Vector2 pos2, float ra
     return distance <= (radius1 + radius2);
 }
 
+// a client we can't write to. its session thread sees the socket close and
+// removes it with remove_client, so the slot is never freed while the session
+// still owns the player stored under the same key. the caller holds clients_mutex.
+void drop_client(ClientSession& client) {
+    client.send_failed = true;
+    {
+        std::lock_guard<std::mutex> lock(client.send_queue->mutex);
+        client.send_queue->failed = true;
+    }
+    client.send_queue->ready.notify_one();
+    boost::system::error_code ec;
+    client.socket->shutdown(tcp::socket::shutdown_both, ec);
+}
+
+// hands the queue to the socket one message at a time. blocking here only
+// holds up this client.
+void client_writer(std::shared_ptr<tcp::socket> socket, std::shared_ptr<SendQueue> queue) {
+    std::string msg;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->write_started_us = 0;
+            queue->bytes -= msg.size();
+            if (!msg.empty() && queue->spare.size() < SPARE_MESSAGES) {
+                msg.clear();
+                queue->spare.push_back(std::move(msg));
+            }
+            queue->ready.wait(lock, [&] { return queue->closed || queue->failed || !queue->messages.empty(); });
+            if (queue->closed || queue->failed) break;
+            msg = std::move(queue->messages.front());
+            queue->messages.pop_front();
+            queue->write_started_us = now_us();
+        }
+        boost::system::error_code ec;
+        boost::asio::write(*socket, boost::asio::buffer(msg), ec);
+        if (ec) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->failed = true;
+            break;
+        }
+    }
+    // the session thread notices and cleans up
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->failed) {
+        boost::system::error_code ec;
+        socket->shutdown(tcp::socket::shutdown_both, ec);
+    }
+}
+
+// sizes the client's snapshot limit to its socket and starts its writer. the caller holds clients_mutex.
+void start_writer(ClientSession& client) {
+    // linux reports twice the buffer it holds for data, the rest is its bookkeeping
+    boost::asio::socket_base::send_buffer_size send_buffer;
+    boost::system::error_code ec;
+    client.socket->get_option(send_buffer, ec);
+    client.send_limit = SEND_QUEUE_LIMIT;
+    if (!ec && send_buffer.value() > 0) {
+        client.send_limit = std::min(SEND_QUEUE_LIMIT, static_cast<size_t>(send_buffer.value()) / 2);
+    }
+    std::thread(client_writer, client.socket, client.send_queue).detach();
+}
+
+// queues a message for the client's writer. false if the client is past
+// helping: a write failed, or it isn't reading and SEND_BACKLOG_LIMIT is full.
+// the caller holds clients_mutex and drops the client on false.
+bool enqueue(ClientSession& client, const std::string& message) {
+    SendQueue& queue = *client.send_queue;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.closed || queue.failed) return false;
+        if (queue.bytes > 0 && queue.bytes + message.size() > SEND_BACKLOG_LIMIT) {
+            std::cerr << "Client " << client.client_id << " isn't reading, " << queue.bytes << " bytes queued" << std::endl;
+            return false;
+        }
+        std::string copy;
+        if (!queue.spare.empty()) {
+            copy = std::move(queue.spare.back());
+            queue.spare.pop_back();
+        }
+        copy.assign(message);
+        queue.bytes += copy.size();
+        queue.messages.push_back(std::move(copy));
+    }
+    queue.ready.notify_one();
+    return true;
+}
+
+void send_to_client(int client_id, const std::string& message) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    ClientSession* client = clients.find(client_id);
+    if (!client || client->send_failed) return;
+    if (!enqueue(*client, message)) drop_client(*client);
+}
+
+// game events, one line each, sent to every client as they happen:
+//   Hit <shooter> <target>   target is down for RESPAWN_DELAY, can't be hit and its shots are rejected
+//   Respawn <id>             id is back up
+//   Score <id> <score>
+//   Win <id>                 game over, the next one starts after RESTART_COUNTDOWN or once all sent Restart
+//   GameRestart              everyone is back up with a score of 0
+//   Player <id> joined|left
+// and only to the shooter:
+//   Reject <seq>             the shot tagged seq was refused (cooldown, or down), drop its prediction
 void broadcast_to_all(const std::string& message, int sender_id = -1) {
     std::lock_guard<std::mutex> lock(clients_mutex);
     
-    for (auto it = clients.begin(); it != clients.end(); ) {
-        try {
-            // don't send message back to sender
-            if (it->client_id != sender_id && it->socket->is_open()) {
-                boost::asio::write(*it->socket, boost::asio::buffer(message));
-                ++it;
-            } else if (it->client_id == sender_id) {
-                ++it; // skip sender but keep them in the list
-            } else {
-                // socket is closed, remove from list
-                it = clients.erase(it);
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "Error broadcasting to client " << it->client_id << ": " << e.what() << std::endl;
-            // remove client that we can't send to
-            it = clients.erase(it);
-        }
+    for (ClientSession& client : clients) {
+        // don't send message back to sender, nor to clients already on their way out
+        if (client.client_id == sender_id || client.send_failed) continue;
+        if (!client.socket->is_open() || !enqueue(client, message)) drop_client(client);
     }
 }
 
 void remove_client(int client_id) {
     {
         std::lock_guard<std::mutex> lock(clients_mutex);
-        clients.erase(std::remove_if(clients.begin(), clients.end(),
-            [client_id](const ClientSession& client) {
-                return client.client_id == client_id;
-            }), clients.end());
+        if (ClientSession* client = clients.find(client_id)) {
+            std::lock_guard<std::mutex> queue_lock(client->send_queue->mutex);
+            client->send_queue->closed = true;
+            client->send_queue->ready.notify_one();
+        }
+        clients.erase(client_id);
     }
     
     {
@@ -113,7 +353,9 @@ void remove_client(int client_id) {
         // remove bullets owned by this player
         bullets.erase(std::remove_if(bullets.begin(), bullets.end(),
             [client_id](const Bullet& b) {
-                return b.owner_id == client_id;
+                if (b.owner_id != client_id) return false;
+                timers.cancel(b.expiry);
+                return true;
             }), bullets.end());
     }
 }
@@ -142,121 +384,529 @@ std::vector<std::string> split_by_space(const std::string& input) {
 }
 
 void update_bullet_position(Bullet& bullet, float dt) {
-    Vector2 dir = {0, 0};
+    bullet.position.x += bullet.velocity.x * dt;
+    bullet.position.y += bullet.velocity.y * dt;
+}
+
+uint32_t seconds_to_ticks(float seconds) {
+    return static_cast<uint32_t>(std::ceil(seconds * TICK_RATE));
+}
+
+// expands one shot into bullets using the weapon table. the caller holds game_state_mutex.
+bool fire_weapon(int client_id, int weapon_index, float aim_degrees, uint32_t shot_seq) {
+    Player* found = players.find(client_id);
+    if (!found) return false;
+    Player& player = *found;
+    // a client firing right on the cooldown sees its shots land in adjacent ticks
+    // with jitter, so one tick early is let through. the next cooldown still
+    // counts from when this shot was due, so the rate can't creep up.
+    if (!player.alive || server_tick + FIRE_SLACK_TICKS < player.next_fire_tick) return false;
+
+    // cooldown and lifetime together bound how many bullets one player can have alive
+    const WeaponDef& weapon = WEAPONS[weapon_index];
+    player.next_fire_tick = std::max(server_tick, player.next_fire_tick) + seconds_to_ticks(weapon.cooldown);
+    uint32_t expires = server_tick + seconds_to_ticks(weapon.lifetime);
+
+    uint32_t pellet = 0;
+    for_each_pellet(weapon, aim_degrees, [&](float vx, float vy) {
+        Bullet& bullet = bullets.emplace_back(client_id, player.position, Vector2(vx, vy));
+        bullet.id = next_bullet_id++;
+        bullet.shot_seq = shot_seq;
+        bullet.pellet = pellet++;
+        bullet.expiry = timers.schedule(expires, {TimerKind::BulletExpire, bullet.id});
+    });
+    return true;
+}
+
+// resets scores and bullets and starts a new game. the caller holds game_state_mutex.
+void restart_game() {
+    for (Player& player : players) {
+        player.score = 0;
+        player.alive = true;
+        player.last_activity_tick = server_tick; // waiting out the game over wasn't idling
+    }
+    for (const auto& bullet : bullets) timers.cancel(bullet.expiry);
+    bullets.clear();
+    timers.cancel(restart_timer);
+    players_ready_to_restart.clear();
+    current_game_state = GameState::Playing;
+    
+    broadcast_to_all("GameRestart\n");
+    std::cout << "Game restarted" << std::endl;
+}
+
+// removes bullets by id in one pass. ids must be sorted, bullets are kept in id order.
+void remove_bullets_by_id(const std::vector<uint32_t>& ids) {
+    if (ids.empty()) return;
+    size_t next_id = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < bullets.size(); i++) {
+        while (next_id < ids.size() && ids[next_id] < bullets[i].id) next_id++;
+        if (next_id < ids.size() && ids[next_id] == bullets[i].id) continue;
+        if (kept != i) bullets[kept] = std::move(bullets[i]);
+        kept++;
+    }
+    bullets.erase(bullets.begin() + kept, bullets.end());
+}
 
-    if (bullet.direction == "top_right")        dir = { 1, -1 };
-    else if (bullet.direction == "top_left")    dir = { -1, -1 };
-    else if (bullet.direction == "bottom_right")dir = { 1, 1 };
-    else if (bullet.direction == "bottom_left") dir = { -1, 1 };
-    else if (bullet.direction == "up")          dir = { 0, -1 };
-    else if (bullet.direction == "down")        dir = { 0, 1 };
-    else if (bullet.direction == "left")        dir = { -1, 0 };
-    else if (bullet.direction == "right")       dir = { 1, 0 };
+// shuts the socket of a client that stopped talking, its session thread cleans up
+void kick_client(int client_id) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    ClientSession* client = clients.find(client_id);
+    if (!client) return;
+    boost::system::error_code ec;
+    client->socket->shutdown(tcp::socket::shutdown_both, ec);
+    std::cout << "Kicked idle client " << client_id << std::endl;
+}
 
-    bullet.position.x += dir.x * bullet.speed * dt;
-    bullet.position.y += dir.y * bullet.speed * dt;
+// fires every timer due by server_tick. the caller holds game_state_mutex.
+void run_timers() {
+    TRACE_SCOPE("timers");
+    expired_bullets.clear();
+    
+    timers.advance(server_tick, [](const TimerEvent& event) {
+        switch (event.kind) {
+        case TimerKind::BulletExpire:
+            expired_bullets.push_back(event.id);
+            break;
+        case TimerKind::Respawn: {
+            Player* player = players.find(event.id);
+            if (!player) break;
+            player->alive = true;
+            broadcast_to_all("Respawn " + std::to_string(event.id) + "\n");
+            break;
+        }
+        case TimerKind::RestartCountdown:
+            restart_game();
+            break;
+        case TimerKind::IdleCheck: {
+            Player* player = players.find(event.id);
+            if (!player) break;
+            uint32_t idle_ticks = seconds_to_ticks(IDLE_TIMEOUT);
+            // nobody moves while down or between games, start counting again from now
+            if (current_game_state != GameState::Playing || !player->alive) {
+                player->last_activity_tick = server_tick;
+            }
+            // activity doesn't touch the wheel, the check just re-arms from the last message
+            uint32_t deadline = player->last_activity_tick + idle_ticks;
+            if (server_tick >= deadline) {
+                kick_client(player->client_id);
+            } else {
+                timers.schedule(deadline, event);
+            }
+            break;
+        }
+        }
+    });
+    
+    // expired bullets are reclaimed together instead of checking every bullet every tick
+    std::sort(expired_bullets.begin(), expired_bullets.end());
+    remove_bullets_by_id(expired_bullets);
+}
+
+void update_bullets(float dt) {
+    std::lock_guard<std::mutex> lock(game_state_mutex);
+    TRACE_SCOPE("bullets");
+    jobs->parallel_for(bullets.size(), BULLET_CHUNK, [dt](size_t begin, size_t end, unsigned) {
+        TRACE_SCOPE("bullet chunk");
+        for (size_t i = begin; i < end; i++) {
+            update_bullet_position(bullets[i], dt);
+        }
+    });
 }
 
 void process_collisions() {
     std::lock_guard<std::mutex> lock(game_state_mutex);
+    TRACE_SCOPE("collisions");
     
     // don't process collisions if game is over
     if (current_game_state != GameState::Playing) {
         return;
     }
     
-    for (auto bullet_it = bullets.begin(); bullet_it != bullets.end();) {
-        bool bullet_removed = false;
-        
-        // check collision with all players except the bullet owner
-        for (auto& [player_id, player] : players) {
-            if (player_id != bullet_it->owner_id) {
-                if (check_collision_circles(bullet_it->position, Bullet::RADIUS,
-                                          player.position, player.radius)) {
-                    
-                    // player hit! Update scores - use find() instead of []
-                    auto owner_it = players.find(bullet_it->owner_id);
-                    if (owner_it != players.end()) {
-                        owner_it->second.score++;
-
-                        // broadcast updated score
-                        std::string score_msg = "Score " + std::to_string(owner_it->first) + " " + std::to_string(owner_it->second.score) + "\n";
-                        broadcast_to_all(score_msg);
-
-                        // check win condition
-                        if (owner_it->second.score >= MAX_SCORE) {
-                            std::string win_msg = "Win " + std::to_string(owner_it->first) + "\n";
-                            broadcast_to_all(win_msg);
-                            std::cout << "Player " << owner_it->first << " wins!" << std::endl;
-
-                            // change game state to game over
-                            current_game_state = GameState::GameOver;
-                            players_ready_to_restart.clear();
-                        }
-                    }
-                    
-                    // broadcast hit message
-                    std::string hit_msg = "Hit " + std::to_string(bullet_it->owner_id) + 
-                                         " " + std::to_string(player_id) + "\n";
-                    broadcast_to_all(hit_msg);
-                    
-                    // remove bullet
-                    bullet_it = bullets.erase(bullet_it);
-                    bullet_removed = true;
+    // players in id order, so which player a bullet hits first never depends on
+    // the order joins and leaves left the dense array in
+    std::vector<const Player*>& targets = collision_targets;
+    targets.clear();
+    for (const Player& player : players) {
+        if (player.alive) targets.push_back(&player);
+    }
+    std::sort(targets.begin(), targets.end(),
+        [](const Player* a, const Player* b) { return a->client_id < b->client_id; });
+    
+    // query phase: read-only, each job thread records hits in its own buffer
+    for (auto& buffer : hit_buffers) buffer.clear();
+    jobs->parallel_for(bullets.size(), BULLET_CHUNK, [&](size_t begin, size_t end, unsigned worker) {
+        TRACE_SCOPE("collision chunk");
+        auto& hits = hit_buffers[worker];
+        for (size_t i = begin; i < end; i++) {
+            const Bullet& bullet = bullets[i];
+            bool hit = false;
+            
+            // check collision with all players except the bullet owner
+            for (const Player* player : targets) {
+                if (player->client_id != bullet.owner_id &&
+                    check_collision_circles(bullet.position, Bullet::RADIUS,
+                                            player->position, player->radius)) {
+                    hits.push_back({i, player->client_id});
+                    hit = true;
                     break;
                 }
             }
+            
+            // check if bullet is out of bounds or inside a wall, one tile lookup
+            if (!hit && (bullet.position.x < 0 || bullet.position.x > arena_width ||
+                         bullet.position.y < 0 || bullet.position.y > arena_height ||
+                         game_map.solid_at(bullet.position.x, bullet.position.y))) {
+                hits.push_back({i, -1});
+            }
         }
+    });
+    
+    // merge in bullet order so scoring is identical however the chunks were scheduled
+    std::vector<BulletHit>& hits = collision_hits;
+    hits.clear();
+    for (const auto& buffer : hit_buffers) hits.insert(hits.end(), buffer.begin(), buffer.end());
+    std::sort(hits.begin(), hits.end(),
+        [](const BulletHit& a, const BulletHit& b) { return a.bullet_index < b.bullet_index; });
+    
+    // apply phase: serial
+    for (const BulletHit& hit : hits) {
+        const Bullet& bullet = bullets[hit.bullet_index];
+        timers.cancel(bullet.expiry);
+        if (hit.target_id < 0) continue;
         
-        if (!bullet_removed) {
-            // check if bullet is out of bounds
-            if (bullet_it->position.x < 0 || bullet_it->position.x > SCREEN_WIDTH ||
-                bullet_it->position.y < 0 || bullet_it->position.y > SCREEN_HEIGHT) {
-                bullet_it = bullets.erase(bullet_it);
-            } else {
-                ++bullet_it;
+        // a player already hit by an earlier bullet this tick absorbs the rest
+        Player* target = players.find(hit.target_id);
+        if (!target || !target->alive) continue;
+        target->alive = false;
+        timers.schedule(server_tick + seconds_to_ticks(RESPAWN_DELAY),
+                        {TimerKind::Respawn, static_cast<uint32_t>(hit.target_id)});
+        
+        // player hit! Update scores - use find() instead of []
+        Player* owner = players.find(bullet.owner_id);
+        if (owner) {
+            owner->score++;
+
+            // broadcast updated score
+            std::string score_msg = "Score " + std::to_string(owner->client_id) + " " + std::to_string(owner->score) + "\n";
+            broadcast_to_all(score_msg);
+
+            // check win condition
+            if (owner->score >= MAX_SCORE) {
+                std::string win_msg = "Win " + std::to_string(owner->client_id) + "\n";
+                broadcast_to_all(win_msg);
+                std::cout << "Player " << owner->client_id << " wins!" << std::endl;
+
+                // change game state to game over and count down to the next game
+                current_game_state = GameState::GameOver;
+                players_ready_to_restart.clear();
+                restart_timer = timers.schedule(server_tick + seconds_to_ticks(RESTART_COUNTDOWN),
+                                                {TimerKind::RestartCountdown, 0});
+            }
+        }
+        
+        // broadcast hit message
+        std::string hit_msg = "Hit " + std::to_string(bullet.owner_id) + 
+                             " " + std::to_string(hit.target_id) + "\n";
+        broadcast_to_all(hit_msg);
+    }
+    
+    // remove every bullet that hit something, a wall, or left the arena
+    if (!hits.empty()) {
+        size_t next_hit = 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < bullets.size(); i++) {
+            if (next_hit < hits.size() && hits[next_hit].bullet_index == i) {
+                next_hit++;
+                continue;
             }
+            if (kept != i) bullets[kept] = std::move(bullets[i]);
+            kept++;
         }
+        bullets.erase(bullets.begin() + kept, bullets.end());
     }
 }
 
-void game_loop() {
-    auto last_time = std::chrono::high_resolution_clock::now();
+WorldSnapshot build_snapshot() {
+    TRACE_SCOPE("snapshot build");
+    WorldSnapshot snap;
+    snap.tick = server_tick;
+    snap.bullets.reserve(bullets.size());
+    for (const auto& bullet : bullets) {
+        snap.bullets.push_back({bullet.id, bullet.position.x, bullet.position.y,
+                                bullet.velocity.x, bullet.velocity.y,
+                                bullet.owner_id, bullet.shot_seq, bullet.pellet});
+    }
+    // ids are handed out in increasing order, but keep the encoder's invariant explicit
+    std::sort(snap.bullets.begin(), snap.bullets.end(),
+        [](const BulletState& a, const BulletState& b) { return a.id < b.id; });
+
+    // new shots enter the world here, stale stamps go
+    uint64_t now = now_us();
+    for (ShotStamp& stamp : shot_stamps) {
+        if (stamp.server_sim == 0) stamp.server_sim = now;
+    }
+    uint64_t stamp_lifetime_us = static_cast<uint64_t>(SHOT_STAMP_LIFETIME * 1e6f);
+    while (!shot_stamps.empty() && now - shot_stamps.front().server_recv > stamp_lifetime_us) {
+        shot_stamps.pop_front();
+        first_shot_stamp++;
+    }
+
+    // publish every player once per tick, however many position messages arrived
+    snap.players.reserve(players.size());
+    for (Player& player : players) {
+        if (player.dirty) {
+            player.changed_tick = server_tick;
+            player.dirty = false;
+        }
+        snap.players.push_back({player.client_id, player.position.x, player.position.y, player.changed_tick});
+    }
+    std::sort(snap.players.begin(), snap.players.end(),
+        [](const PlayerState& a, const PlayerState& b) { return a.id < b.id; });
+
+    bullet_grid.build(snap.bullets.size(), [&snap](size_t i) {
+        return std::pair{snap.bullets[i].x, snap.bullets[i].y};
+    });
+    player_grid.build(snap.players.size(), [&snap](size_t i) {
+        return std::pair{snap.players[i].x, snap.players[i].y};
+    });
+    return snap;
+}
+
+// filters the tick's snapshot down to what one client can see: its viewport
+// around its player plus a margin. entities entering or leaving that area show
+// up in the delta as added or removed.
+void build_view(ClientSession& client, const WorldSnapshot& snap) {
+    WorldSnapshot& view = client.view;
+    if (client.spectator) {
+        view = snap;
+        return;
+    }
+
+    view.tick = snap.tick;
+    view.bullets.clear();
+    view.players.clear();
+
+    Vector2 center(arena_width / 2, arena_height / 2);
+    if (const Player* player = players.find(client.client_id)) center = player->position;
+    float half_width = client.view_width / 2 + INTEREST_MARGIN;
+    float half_height = client.view_height / 2 + INTEREST_MARGIN;
+    float min_x = center.x - half_width, max_x = center.x + half_width;
+    float min_y = center.y - half_height, max_y = center.y + half_height;
+
+    // on a degraded link far bullets are the first thing to go
+    float range = client.rate.send_level().bullet_range;
+    float bullet_half_width = half_width * range, bullet_half_height = half_height * range;
+
+    // indices into the snapshot are in id order, sorting them keeps the view sorted too
+    client.visible.clear();
+    bullet_grid.query(center.x - bullet_half_width, center.y - bullet_half_height,
+                      center.x + bullet_half_width, center.y + bullet_half_height, client.visible);
+    std::sort(client.visible.begin(), client.visible.end());
+    for (uint32_t index : client.visible) view.bullets.push_back(snap.bullets[index]);
+
+    client.visible.clear();
+    player_grid.query(min_x, min_y, max_x, max_y, client.visible);
+    std::sort(client.visible.begin(), client.visible.end());
+    for (uint32_t index : client.visible) view.players.push_back(snap.players[index]);
+}
+
+// bytes written to the socket that the kernel hasn't sent yet
+size_t unsent_bytes(tcp::socket& socket) {
+    int queued = 0;
+    if (ioctl(socket.native_handle(), SIOCOUTQ, &queued) != 0) return 0;
+    return static_cast<size_t>(std::max(queued, 0));
+}
+
+// samples the send queue every tick and closes a measurement window every RATE_WINDOW ticks.
+// returns false for a client whose writer has been stuck on one write for SEND_STALL_TIMEOUT.
+bool update_link(ClientSession& client) {
+    uint64_t stalled_us = 0;
+    {
+        std::lock_guard<std::mutex> lock(client.send_queue->mutex);
+        client.queued_bytes = unsent_bytes(*client.socket) + client.send_queue->bytes;
+        if (client.send_queue->write_started_us != 0) stalled_us = now_us() - client.send_queue->write_started_us;
+    }
+    if (stalled_us > SEND_STALL_TIMEOUT * 1e6f) {
+        std::cerr << "Client " << client.client_id << " stopped reading, " << client.queued_bytes << " bytes unsent" << std::endl;
+        return false;
+    }
+    if (server_tick % RATE_WINDOW != 0) return true;
     
-    while (true) {
-        auto current_time = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float>(current_time - last_time).count();
-        last_time = current_time;
-        
-        // update bullets
-        {
-            std::lock_guard<std::mutex> lock(game_state_mutex);
-            for (auto& bullet : bullets) {
-                update_bullet_position(bullet, dt);
+    int old_level = client.rate.level();
+    client.rate.on_window(RATE_WINDOW / TICK_RATE, client.window_bytes, client.queued_bytes);
+    client.window_bytes = 0;
+    if (client.rate.level() != old_level) {
+        std::cout << "Client " << client.client_id << " send level " << old_level << " -> " << client.rate.level()
+                  << " (rtt " << client.rate.srtt_ms() << "ms, " << client.rate.throughput_bytes() / 1024.0f
+                  << " KiB/s, " << client.queued_bytes << " bytes queued)" << std::endl;
+    }
+    return true;
+}
+
+// Lat lines for new shots whose first bullet is in this client's view, stamped
+// with the time the snapshot carrying them is encoded. shots out of view are
+// skipped for good. the caller holds game_state_mutex and has built the view.
+void append_shot_stamps(ClientSession& client) {
+    uint64_t end = first_shot_stamp + shot_stamps.size();
+    uint64_t send_us = now_us();
+    for (uint64_t n = std::max(client.next_shot_stamp, first_shot_stamp); n < end; n++) {
+        const ShotStamp& stamp = shot_stamps[n - first_shot_stamp];
+        const auto& visible = client.view.bullets;
+        auto it = std::lower_bound(visible.begin(), visible.end(), stamp.first_bullet_id,
+            [](const BulletState& bullet, uint32_t id) { return bullet.id < id; });
+        if (it == visible.end() || it->id != stamp.first_bullet_id) continue;
+        append_line(client.outbox, "Lat %u %u %d %llu %llu %llu %llu %llu\n",
+                    stamp.first_bullet_id, stamp.pellets, stamp.owner_id,
+                    static_cast<unsigned long long>(stamp.input),
+                    static_cast<unsigned long long>(stamp.client_send),
+                    static_cast<unsigned long long>(stamp.server_recv),
+                    static_cast<unsigned long long>(stamp.server_sim),
+                    static_cast<unsigned long long>(send_us));
+    }
+    client.next_shot_stamp = end;
+}
+
+void send_snapshots(const WorldSnapshot& snap) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    TRACE_SCOPE("send");
+    
+    // encode and write in parallel, every client has its own socket and buffer
+    jobs->parallel_for(clients.size(), CLIENT_CHUNK, [&snap](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            ClientSession& client = clients.value_at(i);
+            TRACE_SCOPE("send client", client.client_id);
+            client.outbox.clear();
+            if (client.send_failed) continue;
+            if (!client.socket->is_open() || !update_link(client)) {
+                drop_client(client);
+                continue;
+            }
+            
+            if (server_tick >= client.next_ping_tick) {
+                append_line(client.outbox, "Ping %u %llu %llu\n", ++client.ping_seq,
+                            static_cast<unsigned long long>(now_us()),
+                            static_cast<unsigned long long>(client.last_rtt_ms * 1000.0f));
+                client.next_ping_tick = server_tick + seconds_to_ticks(PING_INTERVAL);
+            }
+            
+            // a slow link gets fewer, current snapshots instead of a backlog of stale ones.
+            // deltas are against the acked baseline, so skipped ticks cost nothing to catch up.
+            bool sent_snapshot = false;
+            if (server_tick >= client.next_send_tick && client.queued_bytes < client.send_limit) {
+                TRACE_SCOPE("encode", client.client_id);
+                build_view(client, snap);
+                if (client.measure_latency) append_shot_stamps(client);
+                
+                // fall back to a keyframe if the acked baseline is no longer in history
+                const WorldSnapshot* base = client.history.find(client.acked_tick);
+                sent_snapshot = encode_snapshot(base, client.view, client.outbox);
+                if (sent_snapshot) client.next_send_tick = server_tick + client.rate.send_level().interval_ticks;
+            }
+            if (client.outbox.empty()) continue; // nothing changed since the baseline
+            
+            if (!enqueue(client, client.outbox)) {
+                drop_client(client);
+                continue;
             }
+            client.window_bytes += client.outbox.size();
+            if (sent_snapshot) client.history.push(client.view);
         }
-        
-        // process collisions
-        process_collisions();
-        
-        // broadcast bullet positions to all clients
+    });
+}
+
+void handle_snapshot_ack(int client_id, uint32_t tick) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    ClientSession* client = clients.find(client_id);
+    if (!client) return;
+    if (tick == 0) {
+        // client lost its baseline, next snapshot is a keyframe
+        client->acked_tick = 0;
+        client->history.clear();
+    } else if (tick > client->acked_tick) {
+        client->acked_tick = tick;
+    }
+}
+
+// answer to our Ping: "Pong <seq> <server_us> <client_us>", the server stamp is echoed back
+void handle_pong(int client_id, uint64_t sent_us) {
+    uint64_t now = now_us();
+    if (sent_us > now) return;
+    float rtt_ms = (now - sent_us) / 1000.0f;
+    
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    ClientSession* client = clients.find(client_id);
+    if (!client) return;
+    client->last_rtt_ms = rtt_ms;
+    client->rate.on_rtt_sample(rtt_ms);
+}
+
+void handle_viewport(int client_id, float width, float height) {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    ClientSession* client = clients.find(client_id);
+    if (!client) return;
+    client->view_width = std::clamp(width, 320.0f, arena_width);
+    client->view_height = std::clamp(height, 240.0f, arena_height);
+}
+
+// writes the last `seconds` of traces to a new file in the working directory.
+// returns its path, or an empty string if it couldn't be written.
+std::string write_trace(double seconds) {
+    char path[64];
+    snprintf(path, sizeof(path), "server-trace-%d-%llu.json", static_cast<int>(getpid()),
+             static_cast<unsigned long long>(now_us() / 1000));
+    std::string error;
+    if (!trace_write_json(path, seconds, error)) {
+        std::cerr << "Trace dump failed: " << error << std::endl;
+        return "";
+    }
+    std::cout << "Wrote trace " << path << std::endl;
+    return path;
+}
+
+void game_loop() {
+    trace_set_thread_name("game");
+    
+    // fixed timestep, so a replay of the same inputs simulates the same world
+    const float dt = 1.0f / TICK_RATE;
+    const auto tick_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<float>(dt));
+    auto next_tick = std::chrono::steady_clock::now();
+    
+    while (true) {
         {
-            std::lock_guard<std::mutex> lock(game_state_mutex);
+            TRACE_SCOPE("tick");
+            
+            // update bullets
+            update_bullets(dt);
             
-            broadcast_to_all("BulletsStart\n");
+            // process collisions
+            process_collisions();
             
-            for (const auto& bullet : bullets) {
-                std::string bullet_msg = "Bullet " + std::to_string(bullet.position.x) + 
-                                       " " + std::to_string(bullet.position.y) + 
-                                       " " + bullet.direction + 
-                                       " " + std::to_string(bullet.speed) + 
-                                       " " + std::to_string(Bullet::RADIUS) + "\n";
-                broadcast_to_all(bullet_msg);
+            // send each client the changes since its last acked snapshot
+            {
+                std::lock_guard<std::mutex> lock(game_state_mutex);
+                server_tick++;
+                run_timers();
+                send_snapshots(build_snapshot());
             }
         }
         
-        // sleep to maintain tick rate
-        std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(1000.0f / TICK_RATE)));
+        if (trace_dump_requested.exchange(false)) {
+            std::thread(write_trace, TRACE_DUMP_SECONDS).detach();
+        }
+        
+        // sleep to maintain tick rate, without bursting to catch up after a stall
+        next_tick += tick_duration;
+        auto now = std::chrono::steady_clock::now();
+        float late_ms = 0.0f;
+        if (next_tick < now) {
+            late_ms = std::chrono::duration<float, std::milli>(now - next_tick).count();
+            next_tick = now;
+        }
+        tick_lateness_ms.store(tick_lateness_ms.load() * 0.9f + late_ms * 0.1f);
+        std::this_thread::sleep_until(next_tick);
     }
 }
 
@@ -276,48 +926,110 @@ void handle_client_message(const std::string& message, int client_id) {
                 x_str.pop_back();
             }
             
-            float x = std::stof(x_str);
-            float y = std::stof(y_str);
+            float x = std::clamp(std::stof(x_str), 0.0f, arena_width);
+            float y = std::clamp(std::stof(y_str), 0.0f, arena_height);
             
             // update player position
             {
                 std::lock_guard<std::mutex> lock(game_state_mutex);
-                auto player_it = players.find(client_id);
-                if (player_it != players.end()) {
-                    player_it->second.position = Vector2(x, y);
-                } else {
-                    players[client_id] = Player(client_id, Vector2(x, y));
-                }
+                // no player means the session is being torn down
+                Player* player = players.find(client_id);
+                if (!player) return;
+                // clients resolve walls themselves, positions inside one are ignored
+                if (game_map.circle_hits_wall(x, y, player->radius)) return;
+                player->position = Vector2(x, y);
+                player->dirty = true;
             }
             
-            // broadcast to other clients
-            std::string broadcast_message = "Client " + std::to_string(client_id) + ": " + message + "\n";
-            broadcast_to_all(broadcast_message, client_id);
-            
+            // other clients see the new position in the next tick's snapshot
         } catch (const std::exception& e) {
             std::cerr << "Error parsing position from client " << client_id << ": " << e.what() << std::endl;
         }
     }
-    else if (tokens[0] == "Shot" && tokens.size() >= 5) {
+    else if (tokens[0] == "Fire" && tokens.size() >= 3) {
         try {
-            // parse bullet: "Shot x y speed direction"
-            float x = std::stof(tokens[1]);
-            float y = std::stof(tokens[2]);
-            float speed = std::stof(tokens[3]);
-            std::string direction = tokens[4];
+            // parse shot: "Fire weapon aim_degrees [seq [input_us send_us]]", pellets are
+            // expanded server side. the optional stamps are on our clock, see latency.hpp.
+            uint64_t recv_us = now_us();
+            int weapon_index = std::stoi(tokens[1]);
+            float aim = std::stof(tokens[2]);
+            uint32_t shot_seq = tokens.size() >= 4 ? static_cast<uint32_t>(std::stoul(tokens[3])) : 0;
+            bool stamped = tokens.size() >= 6;
+            uint64_t input_us = stamped ? std::stoull(tokens[4]) : 0;
+            uint64_t send_us = stamped ? std::stoull(tokens[5]) : 0;
+            // the client's clock estimate is off by a little at most, anything else is garbage
+            if (input_us > send_us || send_us > recv_us + 1000000) stamped = false;
+            if (weapon_index < 0 || weapon_index >= WEAPON_COUNT || !std::isfinite(aim)) {
+                std::cerr << "Invalid fire command from client " << client_id << ": " << message << std::endl;
+                return;
+            }
             
-            // add bullet to server state
+            bool fired;
             {
                 std::lock_guard<std::mutex> lock(game_state_mutex);
-                bullets.emplace_back(client_id, Vector2(x, y), speed, direction);
+                uint32_t first_bullet_id = next_bullet_id;
+                fired = fire_weapon(client_id, weapon_index, aim, shot_seq);
+                if (fired && stamped) {
+                    shot_stamps.push_back({first_bullet_id, next_bullet_id - first_bullet_id, client_id,
+                                           input_us, send_us, recv_us});
+                }
             }
             
-            std::cout << "Client " << client_id << " fired bullet at (" << x << ", " << y << ") direction: " << direction << std::endl;
+            if (fired) {
+                std::cout << "Client " << client_id << " fired " << WEAPONS[weapon_index].name << " at " << aim << " degrees" << std::endl;
+            } else if (shot_seq != 0) {
+                // the client already drew this shot, tell it to take it back
+                send_to_client(client_id, "Reject " + std::to_string(shot_seq) + "\n");
+            }
             
         } catch (const std::exception& e) {
             std::cerr << "Error parsing shot from client " << client_id << ": " << e.what() << std::endl;
         }
     }
+    else if (tokens[0] == "Ack" && tokens.size() >= 2) {
+        try {
+            handle_snapshot_ack(client_id, static_cast<uint32_t>(std::stoul(tokens[1])));
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing ack from client " << client_id << ": " << e.what() << std::endl;
+        }
+    }
+    else if (tokens[0] == "Viewport" && tokens.size() >= 3) {
+        try {
+            handle_viewport(client_id, std::stof(tokens[1]), std::stof(tokens[2]));
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing viewport from client " << client_id << ": " << e.what() << std::endl;
+        }
+    }
+    else if (tokens[0] == "Resync") {
+        handle_snapshot_ack(client_id, 0);
+    }
+    else if (tokens[0] == "Pong" && tokens.size() >= 3) {
+        try {
+            handle_pong(client_id, std::stoull(tokens[2]));
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing pong from client " << client_id << ": " << e.what() << std::endl;
+        }
+    }
+    else if (tokens[0] == "Measure") {
+        // opt in to Lat lines, see latency.hpp
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        if (ClientSession* client = clients.find(client_id)) client->measure_latency = true;
+    }
+    else if (tokens[0] == "Join") {
+        // match name, only meaningful to the gateway; one process hosts one match
+    }
+    else if (tokens[0] == "Restart") {
+        // start early once everyone is ready, otherwise the countdown does it
+        std::lock_guard<std::mutex> lock(game_state_mutex);
+        if (current_game_state == GameState::Playing) return;
+        players_ready_to_restart.insert(client_id);
+        current_game_state = GameState::WaitingForRestart;
+        
+        bool all_ready = std::all_of(players.begin(), players.end(), [](const Player& player) {
+            return players_ready_to_restart.count(player.client_id) > 0;
+        });
+        if (all_ready) restart_game();
+    }
     else {
         // for other messages, just broadcast them
         std::string broadcast_message = "Client " + std::to_string(client_id) + ": " + message + "\n";
@@ -325,32 +1037,105 @@ void handle_client_message(const std::string& message, int client_id) {
     }
 }
 
-void session(std::shared_ptr<tcp::socket> socket, int client_id) {
+// arena size and map name, size and checksum, sent to everyone on connect
+std::string world_info() {
+    std::string info = "Arena " + std::to_string(static_cast<int>(arena_width)) + " " +
+                       std::to_string(static_cast<int>(arena_height)) + "\n";
+    if (game_map.loaded()) {
+        info += "Map " + map_name + " " + std::to_string(game_map.file_size()) + " " +
+                std::to_string(map_checksum) + "\n";
+    }
+    return info;
+}
+
+// spectators get snapshots and events like players, but never join the simulation.
+// the only messages they send are snapshot acks and pongs.
+void spectator_session(std::shared_ptr<tcp::socket> socket, boost::asio::streambuf& buf) {
+    int client_id;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        client_id = static_cast<int>(clients.insert(ClientSession(socket, true)));
+        ClientSession& client = *clients.find(client_id);
+        client.client_id = client_id;
+        start_writer(client);
+        enqueue(client, world_info());
+    }
+    std::cout << "Spectator " << client_id << " session started\n";
+    
+    try {
+        while (true) {
+            boost::asio::read_until(*socket, buf, "\n");
+            std::istream is(&buf);
+            std::string line;
+            std::getline(is, line);
+            
+            std::vector<std::string> tokens = split_by_space(line);
+            if (tokens.size() >= 2 && tokens[0] == "Ack") {
+                handle_snapshot_ack(client_id, static_cast<uint32_t>(std::stoul(tokens[1])));
+            } else if (!tokens.empty() && tokens[0] == "Resync") {
+                handle_snapshot_ack(client_id, 0);
+            } else if (tokens.size() >= 3 && tokens[0] == "Pong") {
+                handle_pong(client_id, std::stoull(tokens[2]));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Spectator " << client_id << " left: " << e.what() << std::endl;
+    }
+    
+    remove_client(client_id);
+}
+
+void session(std::shared_ptr<tcp::socket> socket) {
+    int client_id = 0;
     try {
-        std::cout << "Client " << client_id << " session started\n";
         boost::asio::streambuf buf;
         boost::system::error_code error;
         
-        // add client to the list
+        // the first line says whether this is a player (Join) or a spectator
+        boost::asio::read_until(*socket, buf, "\n", error);
+        if (error) {
+            std::cerr << "Client closed before joining: " << error.message() << std::endl;
+            return;
+        }
+        std::string first_line;
+        {
+            std::istream is(&buf);
+            std::getline(is, first_line);
+        }
+        if (first_line.rfind("Spectate", 0) == 0) {
+            spectator_session(socket, buf);
+            return;
+        }
+        
+        // add client to the list, its key is the id everyone knows it by. its id and
+        // the arena go out first, ahead of any snapshot or event.
         {
             std::lock_guard<std::mutex> lock(clients_mutex);
-            clients.emplace_back(socket, client_id);
+            client_id = static_cast<int>(clients.insert(ClientSession(socket)));
+            ClientSession& client = *clients.find(client_id);
+            client.client_id = client_id;
+            start_writer(client);
+            enqueue(client, "Client_ID " + std::to_string(client_id) + "\n" + world_info());
         }
+        std::cout << "Client " << client_id << " session started\n";
+        trace_set_thread_name("session");
         
         // initialize player
         {
             std::lock_guard<std::mutex> lock(game_state_mutex);
-            players[client_id] = Player(client_id, Vector2(SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2));
+            players.emplace_at(client_id, Player(client_id, Vector2(arena_width / 2, arena_height / 2)));
+            Player& player = *players.find(client_id);
+            player.last_activity_tick = server_tick;
+            timers.schedule(server_tick + seconds_to_ticks(IDLE_TIMEOUT),
+                            {TimerKind::IdleCheck, static_cast<uint32_t>(client_id)});
         }
         
-        // send client their ID
-        std::string connection_id = "Client_ID " + std::to_string(client_id) + "\n";
-        boost::asio::write(*socket, boost::asio::buffer(connection_id));
-        
         // notify other clients about new connection
         std::string join_message = "Player " + std::to_string(client_id) + " joined\n";
         broadcast_to_all(join_message, client_id);
         
+        handle_client_message(first_line, client_id);
+        
         while (true) {
             size_t len = boost::asio::read_until(*socket, buf, "\n", error);
             if (error) {
@@ -366,12 +1151,22 @@ void session(std::shared_ptr<tcp::socket> socket, int client_id) {
             std::string line;
             std::getline(is, line);
             
-            // log received data (unless it is position data)
-            if (line.find("Position") == std::string::npos) {
+            // log received data (unless it is position data, a snapshot ack or an RTT probe answer).
+            // shots get their own line once the fire path has accepted them.
+            if (line.find("Position") == std::string::npos && line.rfind("Ack", 0) != 0 &&
+                line.rfind("Pong", 0) != 0 && line.rfind("Fire", 0) != 0) {
                 std::cout << "Client " << client_id << ": " << line << std::endl;
             }
             
+            // what the player sends counts as activity for the idle kick. Pong and Ack
+            // are answered by the client on its own, they'd keep an idle player in forever.
+            if (line.rfind("Pong", 0) != 0 && line.rfind("Ack", 0) != 0) {
+                std::lock_guard<std::mutex> lock(game_state_mutex);
+                if (Player* player = players.find(client_id)) player->last_activity_tick = server_tick;
+            }
+            
             // handle the message
+            TRACE_SCOPE("input", client_id);
             handle_client_message(line, client_id);
         }
     } catch (std::exception& e) {
@@ -386,31 +1181,149 @@ void session(std::shared_ptr<tcp::socket> socket, int client_id) {
     broadcast_to_all(leave_message, client_id);
 }
 
-int main() {
+// one line per command on the localhost-only admin port:
+//   Status  -> "Status players=<n> spectators=<n> rooms=<n> lateness_ms=<ms> draining=<0|1>"
+//   Drain   -> stop taking new matches, running ones play on
+//   Undrain -> take new matches again
+//   Trace <seconds> -> dumps the last seconds of tick traces, "Trace <path>"
+//   Links   -> "Link <id> rtt_ms=<ms> kbps=<n> queued=<bytes> level=<n> hz=<n>" per client, then "LinksEnd"
+void admin_session(std::shared_ptr<tcp::socket> socket) {
+    try {
+        boost::asio::streambuf buf;
+        while (true) {
+            boost::asio::read_until(*socket, buf, "\n");
+            std::istream is(&buf);
+            std::string line;
+            std::getline(is, line);
+            std::vector<std::string> tokens = split_by_space(line);
+            if (tokens.empty()) continue;
+            
+            std::string reply;
+            if (tokens[0] == "Status") {
+                size_t player_count;
+                size_t spectator_count;
+                {
+                    std::lock_guard<std::mutex> lock(game_state_mutex);
+                    player_count = players.size();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(clients_mutex);
+                    spectator_count = std::count_if(clients.begin(), clients.end(),
+                        [](const ClientSession& client) { return client.spectator; });
+                }
+                char status[192];
+                snprintf(status, sizeof(status), "Status players=%zu spectators=%zu rooms=%d lateness_ms=%.2f draining=%d\n",
+                         player_count, spectator_count, player_count > 0 ? 1 : 0, tick_lateness_ms.load(), draining.load() ? 1 : 0);
+                reply = status;
+            } else if (tokens[0] == "Drain") {
+                draining = true;
+                reply = "Draining\n";
+                std::cout << "Draining, no new matches will be placed here" << std::endl;
+            } else if (tokens[0] == "Undrain") {
+                draining = false;
+                reply = "Accepting\n";
+            } else if (tokens[0] == "Trace") {
+                double seconds = tokens.size() >= 2 ? std::atof(tokens[1].c_str()) : TRACE_DUMP_SECONDS;
+                std::string path = write_trace(seconds > 0 ? seconds : TRACE_DUMP_SECONDS);
+                reply = path.empty() ? "TraceFailed\n" : "Trace " + path + "\n";
+            } else if (tokens[0] == "Links") {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                for (const auto& client : clients) {
+                    const SendRateController& rate = client.rate;
+                    append_line(reply, "Link %d rtt_ms=%.1f kbps=%.0f queued=%zu level=%d hz=%.0f\n",
+                                client.client_id, rate.srtt_ms(), rate.throughput_bytes() * 8.0f / 1000.0f,
+                                client.queued_bytes, rate.level(), TICK_RATE / rate.send_level().interval_ticks);
+                }
+                reply += "LinksEnd\n";
+            } else {
+                reply = "Unknown " + tokens[0] + "\n";
+            }
+            boost::asio::write(*socket, boost::asio::buffer(reply));
+        }
+    } catch (const std::exception&) {
+        // admin connection closed
+    }
+}
+
+void admin_loop(unsigned short port) {
     try {
         boost::asio::io_context io_context;
-        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), 8080));
-        std::cout << "Server listening on port 8080...\n";
+        tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port));
+        std::cout << "Admin listening on 127.0.0.1:" << port << "\n";
+        while (true) {
+            auto socket = std::make_shared<tcp::socket>(io_context);
+            acceptor.accept(*socket);
+            std::thread(admin_session, socket).detach();
+        }
+    } catch (std::exception& e) {
+        std::cerr << "Admin error: " << e.what() << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string map_path = DEFAULT_MAP;
+    unsigned short port = 8080;
+    unsigned short admin_port = 0; // 0 = no admin port
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--map" && i + 1 < argc) map_path = argv[++i];
+        else if (arg == "--port" && i + 1 < argc) port = static_cast<unsigned short>(std::stoi(argv[++i]));
+        else if (arg == "--admin-port" && i + 1 < argc) admin_port = static_cast<unsigned short>(std::stoi(argv[++i]));
+    }
+    
+    // kill -USR2 <pid> dumps the last few seconds of tick traces
+    std::signal(SIGUSR2, [](int) { trace_dump_requested = true; });
+    
+    // map before anything reads it. the checksum reads the file once, the game only
+    // touches the pages it needs after that.
+    std::string map_error;
+    if (game_map.open(map_path, map_error)) {
+        map_name = map_path.substr(map_path.find_last_of('/') + 1);
+        map_checksum = game_map.checksum();
+        arena_width = game_map.width();
+        arena_height = game_map.height();
+        bullet_grid = InterestGrid(arena_width, arena_height, INTEREST_CELL);
+        player_grid = InterestGrid(arena_width, arena_height, INTEREST_CELL);
+        std::cout << "Loaded map " << map_path << " (" << arena_width << "x" << arena_height << ")\n";
+    } else {
+        std::cerr << "No map loaded, playing without walls: " << map_error << std::endl;
+    }
+    
+    try {
+        boost::asio::io_context io_context;
+        tcp::acceptor acceptor(io_context, tcp::endpoint(tcp::v4(), port));
+        std::cout << "Server listening on port " << port << "...\n";
+        
+        if (admin_port != 0) {
+            std::thread(admin_loop, admin_port).detach();
+        }
+        
+        // the game thread is worker 0, add one worker per remaining core
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        JobSystem job_system(cores - 1);
+        jobs = &job_system;
+        hit_buffers.resize(job_system.thread_count());
+        for (auto& buffer : hit_buffers) buffer.reserve(BULLET_CHUNK);
+        collision_targets.reserve(64);
+        collision_hits.reserve(BULLET_CHUNK);
+        expired_bullets.reserve(BULLET_CHUNK);
+        std::cout << "Simulating on " << job_system.thread_count() << " threads\n";
         
         // start game loop thread
         std::thread game_thread(game_loop);
         game_thread.detach();
         
-        int next_client_id = 0;
-        
         while (true) {
             auto socket = std::make_shared<tcp::socket>(io_context);
             acceptor.accept(*socket);
-            next_client_id++;
-            int client_id = next_client_id;
             
             auto remote_ep = socket->remote_endpoint();
-            std::cout << "Client " << client_id << " connected from "
+            std::cout << "Connection from "
                       << remote_ep.address().to_string() << ":"
                       << remote_ep.port() << std::endl;
             
-            // launch a thread for this client session
-            std::thread(session, socket, client_id).detach();
+            // launch a thread for this client session, it gets its id once it says what it is
+            std::thread(session, socket).detach();
         }
     } catch (std::exception& e) {
         std::cerr << "Server error: " << e.what() << std::endl;
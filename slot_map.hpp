@@ -0,0 +1,167 @@
+#pragma once
+// dense storage addressed by stable keys, shared by server and client.
+//
+// values sit contiguously in one array, so hot loops walk memory in order
+// instead of chasing hash buckets. a key packs a slot index and that slot's
+// generation. the slot maps the key to the value's position in the dense
+// array, so find and erase are O(1). erase moves the last value into the hole
+// and bumps the slot's generation, so a stale key stops resolving instead of
+// aliasing whoever reuses the slot. dense order is not stable across erases.
+//
+// keys are positive and below 2^31, so they double as ids on the wire. a map
+// holds at most 65536 values at once.
+// emplace_at() stores a value under a key handed out by another map, which
+// is how the client mirrors the server's player ids.
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SlotMap {
+public:
+    using Key = uint32_t;
+    static constexpr Key NONE = 0; // never handed out
+
+    // stores value under a new key
+    Key insert(T value) {
+        uint32_t index = UINT32_MAX;
+        while (!free_slots.empty()) {
+            uint32_t candidate = free_slots.back();
+            free_slots.pop_back();
+            if (slots[candidate].dense == NIL) { // emplace_at may have claimed it meanwhile
+                index = candidate;
+                break;
+            }
+        }
+        if (index == UINT32_MAX) {
+            index = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot{});
+        }
+        Slot& slot = slots[index];
+        if (slot.generation == 0) slot.generation = 1;
+        slot.dense = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        keys.push_back(make_key(index, slot.generation));
+        return keys.back();
+    }
+
+    // stores value under a key from another map, replacing an older entity in its slot.
+    // returns false for a key no SlotMap could have made, and for a key older than
+    // the last one stored in the slot, so a stale key can't evict its successor.
+    bool emplace_at(Key key, T value) {
+        uint32_t index = key & INDEX_MASK;
+        uint32_t generation = key >> INDEX_BITS;
+        if (generation == 0 || generation > GENERATION_MASK) return false;
+        while (slots.size() <= index) {
+            free_slots.push_back(static_cast<uint32_t>(slots.size()));
+            slots.push_back(Slot{});
+        }
+
+        Slot& slot = slots[index];
+        // a free slot's generation was bumped on erase, compare with the value it held
+        uint32_t last = slot.dense != NIL ? slot.generation : previous_generation(slot.generation);
+        if (last != 0 && generation_older(generation, last)) return false;
+        if (slot.dense != NIL) {
+            if (slot.generation == generation) {
+                values[slot.dense] = std::move(value);
+                return true;
+            }
+            erase(make_key(index, slot.generation)); // an older entity in the same slot
+        }
+        slot.generation = generation;
+        slot.dense = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        keys.push_back(key);
+        return true;
+    }
+
+    T* find(Key key) {
+        uint32_t dense = dense_index(key);
+        return dense == NIL ? nullptr : &values[dense];
+    }
+
+    const T* find(Key key) const {
+        uint32_t dense = dense_index(key);
+        return dense == NIL ? nullptr : &values[dense];
+    }
+
+    bool contains(Key key) const { return dense_index(key) != NIL; }
+
+    bool erase(Key key) {
+        uint32_t dense = dense_index(key);
+        if (dense == NIL) return false;
+
+        // fill the hole with the last value so the array stays dense
+        uint32_t last = static_cast<uint32_t>(values.size() - 1);
+        if (dense != last) {
+            values[dense] = std::move(values[last]);
+            keys[dense] = keys[last];
+            slots[keys[dense] & INDEX_MASK].dense = dense;
+        }
+        values.pop_back();
+        keys.pop_back();
+
+        uint32_t index = key & INDEX_MASK;
+        Slot& slot = slots[index];
+        slot.dense = NIL;
+        slot.generation = slot.generation % GENERATION_MASK + 1;
+        free_slots.push_back(index);
+        return true;
+    }
+
+    void clear() {
+        while (!keys.empty()) erase(keys.back());
+    }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    // dense access, positions are only valid until the next insert or erase
+    T& value_at(size_t position) { return values[position]; }
+    const T& value_at(size_t position) const { return values[position]; }
+    Key key_at(size_t position) const { return keys[position]; }
+
+    auto begin() { return values.begin(); }
+    auto end() { return values.end(); }
+    auto begin() const { return values.begin(); }
+    auto end() const { return values.end(); }
+
+private:
+    static constexpr int INDEX_BITS = 16;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t GENERATION_MASK = (1u << (31 - INDEX_BITS)) - 1;
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Slot {
+        uint32_t dense = NIL;    // position in values, NIL when free
+        uint32_t generation = 0; // 1..GENERATION_MASK once used
+    };
+
+    static Key make_key(uint32_t index, uint32_t generation) { return (generation << INDEX_BITS) | index; }
+
+    // generations count 1..GENERATION_MASK and wrap, 0 means never used
+    static uint32_t previous_generation(uint32_t generation) {
+        if (generation == 0) return 0;
+        return generation == 1 ? GENERATION_MASK : generation - 1;
+    }
+
+    // a is older than b if it's behind b by less than half the cycle
+    static bool generation_older(uint32_t a, uint32_t b) {
+        uint32_t behind = (b + GENERATION_MASK - a) % GENERATION_MASK;
+        return behind != 0 && behind < GENERATION_MASK / 2;
+    }
+
+    uint32_t dense_index(Key key) const {
+        uint32_t index = key & INDEX_MASK;
+        if (index >= slots.size()) return NIL;
+        const Slot& slot = slots[index];
+        if (slot.dense == NIL || slot.generation != key >> INDEX_BITS) return NIL;
+        return slot.dense;
+    }
+
+    std::vector<T> values;
+    std::vector<Key> keys; // keys[i] is the key of values[i]
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+};
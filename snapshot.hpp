@@ -0,0 +1,225 @@
+#pragma once
+// world snapshots shared by server and client.
+//
+// the server keeps the last few snapshots it sent to each client and encodes
+// the next one as a delta against the newest snapshot that client has acked.
+// the client keeps the same history of reconstructed snapshots so it can
+// rebuild the full world from a delta.
+//
+// wire format (one message per tick, text lines):
+//   Snap <tick> <base_tick>            base_tick 0 = keyframe
+//   B <id> <x> <y> <vx> <vy> <owner> <seq> <pellet>
+//                                      bullet entered (full state). seq is the
+//                                      owner's tag from Fire, so it can match the
+//                                      bullet to the one it predicted locally
+//   b <id> <x> <y>                     bullet moved
+//   -B <id>                            bullet removed
+//   P <id> <x> <y>                     player entered or moved
+//   -P <id>                            player removed
+//   SnapEnd
+#include <algorithm>
+#include <array>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+const int SNAPSHOT_HISTORY = 32; // ~0.5s at 60 ticks per second
+
+struct BulletState {
+    uint32_t id;
+    float x, y;
+    float vx, vy;
+    int owner = 0;
+    uint32_t seq = 0;    // owner's shot tag, 0 = untagged
+    uint32_t pellet = 0; // index within the shot
+};
+
+struct PlayerState {
+    int id;
+    float x, y;
+    uint32_t changed_tick = 0; // last tick the position changed, server side only
+};
+
+struct WorldSnapshot {
+    uint32_t tick = 0;
+    std::vector<BulletState> bullets; // sorted by id
+    std::vector<PlayerState> players; // sorted by id
+};
+
+// ring buffer of the most recent snapshots, looked up by tick
+class SnapshotHistory {
+public:
+    void push(const WorldSnapshot& snap) {
+        slots[next % SNAPSHOT_HISTORY] = snap;
+        next++;
+    }
+
+    const WorldSnapshot* find(uint32_t tick) const {
+        if (tick == 0) return nullptr;
+        for (const auto& snap : slots) {
+            if (snap.tick == tick) return &snap;
+        }
+        return nullptr;
+    }
+
+    void clear() {
+        for (auto& snap : slots) snap = WorldSnapshot{};
+        next = 0;
+    }
+
+private:
+    std::array<WorldSnapshot, SNAPSHOT_HISTORY> slots;
+    size_t next = 0;
+};
+
+// printf-style append of one short protocol line
+__attribute__((format(printf, 2, 3)))
+inline void append_line(std::string& out, const char* fmt, ...) {
+    char line[128];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len > 0) out.append(line, std::min<size_t>(len, sizeof(line) - 1));
+}
+
+// appends the lines that turn `base` into `current` to `out`.
+// a null base encodes a keyframe. returns false if nothing changed.
+inline bool encode_snapshot(const WorldSnapshot* base, const WorldSnapshot& current, std::string& out) {
+    size_t header_end = out.size();
+    append_line(out, "Snap %u %u\n", current.tick, base ? base->tick : 0u);
+    size_t body_start = out.size();
+
+    static const std::vector<BulletState> empty;
+    const auto& old_bullets = base ? base->bullets : empty;
+
+    // both lists are sorted by id, so one merge pass finds every change
+    size_t i = 0, j = 0;
+    while (i < old_bullets.size() || j < current.bullets.size()) {
+        if (j == current.bullets.size() ||
+            (i < old_bullets.size() && old_bullets[i].id < current.bullets[j].id)) {
+            append_line(out, "-B %u\n", old_bullets[i].id);
+            i++;
+        } else if (i == old_bullets.size() || current.bullets[j].id < old_bullets[i].id) {
+            const BulletState& b = current.bullets[j];
+            append_line(out, "B %u %.1f %.1f %.1f %.1f %d %u %u\n", b.id, b.x, b.y, b.vx, b.vy, b.owner, b.seq, b.pellet);
+            j++;
+        } else {
+            const BulletState& a = old_bullets[i];
+            const BulletState& b = current.bullets[j];
+            if (a.x != b.x || a.y != b.y) {
+                append_line(out, "b %u %.1f %.1f\n", b.id, b.x, b.y);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    static const std::vector<PlayerState> no_players;
+    const auto& old_players = base ? base->players : no_players;
+
+    i = 0;
+    j = 0;
+    while (i < old_players.size() || j < current.players.size()) {
+        if (j == current.players.size() ||
+            (i < old_players.size() && old_players[i].id < current.players[j].id)) {
+            append_line(out, "-P %d\n", old_players[i].id);
+            i++;
+        } else if (i == old_players.size() || current.players[j].id < old_players[i].id) {
+            const PlayerState& p = current.players[j];
+            append_line(out, "P %d %.1f %.1f\n", p.id, p.x, p.y);
+            j++;
+        } else {
+            // players not marked dirty since the baseline can be skipped without comparing
+            const PlayerState& a = old_players[i];
+            const PlayerState& p = current.players[j];
+            if (p.changed_tick > base->tick && (a.x != p.x || a.y != p.y)) {
+                append_line(out, "P %d %.1f %.1f\n", p.id, p.x, p.y);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    bool changed = base == nullptr || out.size() != body_start;
+    if (!changed) {
+        out.resize(header_end);
+        return false;
+    }
+    out += "SnapEnd\n";
+    return true;
+}
+
+// rebuilds a snapshot from a delta, one line at a time
+class SnapshotDecoder {
+public:
+    // starts a new snapshot. returns false if the baseline is unknown,
+    // in which case the client should ask for a keyframe.
+    bool begin(uint32_t tick, uint32_t base_tick, const SnapshotHistory& history) {
+        active = false;
+        current = WorldSnapshot{};
+        if (base_tick != 0) {
+            const WorldSnapshot* base = history.find(base_tick);
+            if (!base) return false;
+            current = *base;
+        }
+        current.tick = tick;
+        active = true;
+        return true;
+    }
+
+    void bullet_added(BulletState bullet) {
+        if (!active) return;
+        auto it = lower_bound_id(bullet.id);
+        if (it != current.bullets.end() && it->id == bullet.id) *it = std::move(bullet);
+        else current.bullets.insert(it, std::move(bullet));
+    }
+
+    void bullet_moved(uint32_t id, float x, float y) {
+        if (!active) return;
+        auto it = lower_bound_id(id);
+        if (it != current.bullets.end() && it->id == id) {
+            it->x = x;
+            it->y = y;
+        }
+    }
+
+    void bullet_removed(uint32_t id) {
+        if (!active) return;
+        auto it = lower_bound_id(id);
+        if (it != current.bullets.end() && it->id == id) current.bullets.erase(it);
+    }
+
+    void player_updated(PlayerState player) {
+        if (!active) return;
+        auto it = std::lower_bound(current.players.begin(), current.players.end(), player.id,
+            [](const PlayerState& p, int value) { return p.id < value; });
+        if (it != current.players.end() && it->id == player.id) *it = player;
+        else current.players.insert(it, player);
+    }
+
+    void player_removed(int id) {
+        if (!active) return;
+        auto it = std::lower_bound(current.players.begin(), current.players.end(), id,
+            [](const PlayerState& p, int value) { return p.id < value; });
+        if (it != current.players.end() && it->id == id) current.players.erase(it);
+    }
+
+    // finishes the snapshot. returns nullptr if begin() failed.
+    const WorldSnapshot* end() {
+        if (!active) return nullptr;
+        active = false;
+        return &current;
+    }
+
+private:
+    std::vector<BulletState>::iterator lower_bound_id(uint32_t id) {
+        return std::lower_bound(current.bullets.begin(), current.bullets.end(), id,
+            [](const BulletState& b, uint32_t value) { return b.id < value; });
+    }
+
+    WorldSnapshot current;
+    bool active = false;
+};
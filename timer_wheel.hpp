@@ -0,0 +1,154 @@
+#pragma once
+// hierarchical timer wheel driven by the server tick counter.
+//
+// four levels of 64 slots cover 2^24 ticks (~77 hours at 60 ticks per second).
+// timers live in a pooled array and are linked into their slot by index, so
+// schedule and cancel are O(1). when the low level wraps, the matching slot of
+// the next level is cascaded down. each timer is touched at most once per level.
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct TimerHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+template <typename T>
+class TimerWheel {
+public:
+    TimerWheel() {
+        for (auto& level : slots) {
+            for (auto& head : level) head = NIL;
+        }
+    }
+
+    uint32_t now() const { return current; }
+
+    // schedules payload to fire at `tick`. ticks in the past fire on the next advance.
+    TimerHandle schedule(uint32_t tick, T payload) {
+        uint32_t index;
+        if (free_head != NIL) {
+            index = free_head;
+            free_head = nodes[index].next;
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node{});
+        }
+        Node& node = nodes[index];
+        node.expire = tick > current ? tick : current + 1;
+        node.payload = std::move(payload);
+        node.active = true;
+        place(index);
+        count++;
+        return {index, node.generation};
+    }
+
+    // cancels a pending timer. returns false if it already fired or was cancelled.
+    bool cancel(TimerHandle handle) {
+        if (handle.index >= nodes.size()) return false;
+        Node& node = nodes[handle.index];
+        if (!node.active || node.generation != handle.generation) return false;
+        unlink(handle.index);
+        release(handle.index);
+        return true;
+    }
+
+    // advances to `tick`, calling fn(payload) for every timer that expires on the way.
+    // fn may schedule or cancel other timers.
+    template <typename Fn>
+    void advance(uint32_t tick, Fn fn) {
+        while (current < tick) {
+            current++;
+            if ((current & MASK) == 0) {
+                for (int level = 1; level < LEVELS; level++) {
+                    uint32_t slot = (current >> (BITS * level)) & MASK;
+                    cascade(level, slot);
+                    if (slot != 0) break;
+                }
+            }
+
+            uint32_t& head = slots[0][current & MASK];
+            while (head != NIL) {
+                uint32_t index = head;
+                unlink(index);
+                T payload = std::move(nodes[index].payload);
+                release(index);
+                fn(payload);
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+
+private:
+    static constexpr int BITS = 6;
+    static constexpr int LEVELS = 4;
+    static constexpr uint32_t SLOTS = 1u << BITS;
+    static constexpr uint32_t MASK = SLOTS - 1;
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        uint32_t expire = 0;
+        uint32_t prev = NIL, next = NIL;
+        uint32_t generation = 0;
+        uint16_t level = 0, slot = 0;
+        bool active = false;
+        T payload{};
+    };
+
+    void place(uint32_t index) {
+        Node& node = nodes[index];
+        uint32_t delta = node.expire > current ? node.expire - current : 0;
+        uint32_t expire = node.expire;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1u << (BITS * (level + 1)))) level++;
+        if (level == LEVELS - 1 && delta >= (1u << (BITS * LEVELS))) {
+            // beyond the wheel's range, park in the furthest slot and re-place on cascade
+            expire = current + (1u << (BITS * LEVELS)) - 1;
+        }
+        uint32_t slot = (delta < SLOTS) ? (node.expire & MASK) : ((expire >> (BITS * level)) & MASK);
+
+        node.level = static_cast<uint16_t>(level);
+        node.slot = static_cast<uint16_t>(slot);
+        node.prev = NIL;
+        node.next = slots[level][slot];
+        if (node.next != NIL) nodes[node.next].prev = index;
+        slots[level][slot] = index;
+    }
+
+    void unlink(uint32_t index) {
+        Node& node = nodes[index];
+        if (node.prev != NIL) nodes[node.prev].next = node.next;
+        else slots[node.level][node.slot] = node.next;
+        if (node.next != NIL) nodes[node.next].prev = node.prev;
+        node.prev = node.next = NIL;
+    }
+
+    void release(uint32_t index) {
+        Node& node = nodes[index];
+        node.active = false;
+        node.generation++;
+        node.payload = T{};
+        node.next = free_head;
+        free_head = index;
+        count--;
+    }
+
+    void cascade(int level, uint32_t slot) {
+        uint32_t index = slots[level][slot];
+        slots[level][slot] = NIL;
+        while (index != NIL) {
+            uint32_t next = nodes[index].next;
+            place(index);
+            index = next;
+        }
+    }
+
+    uint32_t slots[LEVELS][SLOTS];
+    std::vector<Node> nodes;
+    uint32_t free_head = NIL;
+    uint32_t current = 0;
+    size_t count = 0;
+};
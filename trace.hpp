@@ -0,0 +1,181 @@
+#pragma once
+// scoped trace events in per-thread ring buffers, dumped as Chrome trace JSON.
+//
+// TRACE_SCOPE("name") records when the enclosing scope started and how long it
+// ran. each thread writes only its own ring, so recording is two clock reads
+// and a few stores, no locks. rings keep the last TRACE_RING_SIZE events and
+// are always on. trace_write_json() copies the last few seconds from every
+// ring into a file that chrome://tracing or ui.perfetto.dev can open.
+// names must be string literals, only the pointer is stored.
+//
+// spans that don't fit a scope take TRACE_MARK(var) at their start and
+// TRACE_SPAN("name", var, end_var) to record them.
+//
+// build with -DKOMI_NO_TRACE to compile every TRACE_SCOPE, TRACE_MARK and
+// TRACE_SPAN out.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const size_t TRACE_RING_SIZE = 8192; // ~200 KiB per thread, several seconds of ticks
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start_us;
+    uint32_t duration_us;
+    int32_t arg; // client id and the like, -1 = none
+};
+
+struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    std::atomic<uint64_t> head{0}; // events ever written
+    uint32_t tid = 0;
+    char thread_name[32] = "thread";
+    bool in_use = false;           // owned by a live thread, guarded by the registry mutex
+};
+
+namespace trace_detail {
+
+inline const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+// rings outlive their threads so a dump still sees what an exited thread did.
+// a finished thread's ring is handed to the next new thread.
+inline std::mutex registry_mutex;
+inline std::vector<std::unique_ptr<TraceRing>> registry;
+inline uint32_t next_tid = 1;
+
+inline TraceRing* acquire_ring() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto& ring : registry) {
+        if (!ring->in_use) {
+            ring->in_use = true;
+            ring->head.store(0);
+            ring->tid = next_tid++;
+            std::strcpy(ring->thread_name, "thread");
+            return ring.get();
+        }
+    }
+    registry.push_back(std::make_unique<TraceRing>());
+    TraceRing* ring = registry.back().get();
+    ring->in_use = true;
+    ring->tid = next_tid++;
+    return ring;
+}
+
+struct RingOwner {
+    TraceRing* ring = acquire_ring();
+    ~RingOwner() {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        ring->in_use = false;
+    }
+};
+
+inline TraceRing& this_thread_ring() {
+    thread_local RingOwner owner;
+    return *owner.ring;
+}
+
+} // namespace trace_detail
+
+inline uint64_t trace_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - trace_detail::epoch).count();
+}
+
+// label for the calling thread in the trace viewer
+inline void trace_set_thread_name(const char* name) {
+    TraceRing& ring = trace_detail::this_thread_ring();
+    std::lock_guard<std::mutex> lock(trace_detail::registry_mutex);
+    std::snprintf(ring.thread_name, sizeof(ring.thread_name), "%s", name);
+}
+
+inline void trace_record(const char* name, uint64_t start_us, uint64_t end_us, int32_t arg) {
+    TraceRing& ring = trace_detail::this_thread_ring();
+    uint64_t h = ring.head.load(std::memory_order_relaxed);
+    ring.events[h % TRACE_RING_SIZE] = {name, start_us, static_cast<uint32_t>(end_us - start_us), arg};
+    ring.head.store(h + 1, std::memory_order_release);
+}
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, int32_t arg = -1) : name(name), arg(arg), start(trace_now_us()) {}
+    ~TraceScope() { trace_record(name, start, trace_now_us(), arg); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    int32_t arg;
+    uint64_t start;
+};
+
+#ifdef KOMI_NO_TRACE
+#define TRACE_SCOPE(...) ((void)0)
+#define TRACE_MARK(var) ((void)0)
+#define TRACE_SPAN(name, start_var, end_var) ((void)0)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define TRACE_MARK(var) const uint64_t var = trace_now_us()
+#define TRACE_SPAN(name, start_var, end_var) trace_record(name, start_var, end_var, -1)
+#endif
+
+// writes every event that ended in the last `seconds` to path as Chrome trace
+// JSON. safe to call from any thread while others keep recording; the oldest
+// few slots of a ring being overwritten during the copy are skipped.
+inline bool trace_write_json(const std::string& path, double seconds, std::string& error) {
+    uint64_t now = trace_now_us();
+    uint64_t since = seconds * 1e6 < now ? now - static_cast<uint64_t>(seconds * 1e6) : 0;
+    const size_t overwrite_margin = 256;
+
+    struct Copied {
+        uint32_t tid;
+        std::string thread_name;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Copied> copies;
+    {
+        std::lock_guard<std::mutex> lock(trace_detail::registry_mutex);
+        for (const auto& ring : trace_detail::registry) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t count = std::min<uint64_t>(head, TRACE_RING_SIZE - overwrite_margin);
+            Copied copy{ring->tid, ring->thread_name, {}};
+            for (uint64_t i = head - count; i < head; i++) {
+                const TraceEvent& event = ring->events[i % TRACE_RING_SIZE];
+                if (event.start_us + event.duration_us >= since) copy.events.push_back(event);
+            }
+            if (!copy.events.empty()) copies.push_back(std::move(copy));
+        }
+    }
+
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        error = "can't write " + path;
+        return false;
+    }
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto& copy : copies) {
+        std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",\n", copy.tid, copy.thread_name.c_str());
+        first = false;
+        for (const TraceEvent& event : copy.events) {
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%u",
+                         event.name, copy.tid, static_cast<unsigned long long>(event.start_us), event.duration_us);
+            if (event.arg >= 0) std::fprintf(file, ",\"args\":{\"id\":%d}", event.arg);
+            std::fprintf(file, "}");
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    bool ok = std::fclose(file) == 0;
+    if (!ok) error = "error writing " + path;
+    return ok;
+}
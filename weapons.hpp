@@ -0,0 +1,46 @@
+#pragma once
+// weapon definitions shared by server and client.
+//
+// the server is authoritative: a client sends "Fire <weapon> <aim>" and the
+// server expands the pellets from this table. the client only uses the table
+// to predict its own shots and to respect the cooldown locally.
+#include <cmath>
+#include <cstring>
+
+struct WeaponDef {
+    const char* name;
+    int   pellets;         // bullets per shot
+    float spread_degrees;  // total fan angle across all pellets
+    float speed;           // pixels per second
+    float cooldown;        // seconds between shots
+    float lifetime;        // seconds before a bullet expires
+};
+
+const WeaponDef WEAPONS[] = {
+    // name       pellets spread  speed   cooldown lifetime
+    { "pistol",   1,      0.0f,   600.0f, 0.15f,   5.0f },
+    { "shotgun",  3,      90.0f,  600.0f, 0.60f,   1.5f },
+};
+const int WEAPON_COUNT = sizeof(WEAPONS) / sizeof(WEAPONS[0]);
+
+// returns the weapon index for a name, or -1
+inline int find_weapon(const char* name) {
+    for (int i = 0; i < WEAPON_COUNT; i++) {
+        if (std::strcmp(WEAPONS[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// calls fn(vx, vy) for each pellet of one shot. aim is in degrees,
+// counter-clockwise from +x with screen y pointing down.
+template <typename Fn>
+void for_each_pellet(const WeaponDef& weapon, float aim_degrees, Fn fn) {
+    for (int i = 0; i < weapon.pellets; i++) {
+        float angle = aim_degrees;
+        if (weapon.pellets > 1) {
+            angle += -weapon.spread_degrees / 2 + weapon.spread_degrees * i / (weapon.pellets - 1);
+        }
+        float radians = angle * static_cast<float>(M_PI) / 180.0f;
+        fn(std::cos(radians) * weapon.speed, -std::sin(radians) * weapon.speed);
+    }
+}